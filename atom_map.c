@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Open addressing hash map from atoms to pointers, in the style of Swiss
+// tables.
+//
+// Slots are split into groups of 16. Each slot has a control byte that is
+// either ATOM_MAP_EMPTY, or the low 7 bits of the hash of the key stored in
+// it. A lookup hashes the atom once, then compares these 7 bits against the
+// 16 control bytes of a group at once (with SSE2 if available), and only
+// compares keys of slots that matched. If the group has an empty slot the key
+// is not in the map, otherwise the next group is probed (triangular probing,
+// which visits all groups because their number is a power of 2).
+//
+// Maps are created with the number of keys they will hold and allocated in a
+// pool, they are freed with it. They never grow and keys can't be removed,
+// this is all we need for the icon names of a theme, which don't change after
+// the theme is loaded. Keys are atoms, comparing them is as cheap as comparing
+// a stored hash, so only keys are stored.
+//
+// NOTE: Values can't be NULL, atom_map_lookup() returns NULL for missing keys.
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ATOM_MAP_GROUP_SIZE 16
+#define ATOM_MAP_EMPTY 0x80
+
+struct atom_map_t {
+    uint32_t num_groups;
+    uint32_t num_keys;
+
+    uint8_t *ctrl;
+    atom_t *keys;
+    void **values;
+};
+
+static inline
+uint64_t atom_map_hash (atom_t atom)
+{
+    // Finalizer of MurmurHash3, atoms are consecutive integers so they need
+    // mixing before their low bits are usable.
+    uint64_t h = atom;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Returns a bitmask with bit i set if ctrl[i] == tag, for the 16 control bytes
+// of a group.
+static inline
+uint32_t atom_map_group_match (uint8_t *ctrl, uint8_t tag)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128 ((__m128i*)ctrl);
+    return _mm_movemask_epi8 (_mm_cmpeq_epi8 (group, _mm_set1_epi8 (tag)));
+#else
+    uint32_t mask = 0;
+    for (int i=0; i<ATOM_MAP_GROUP_SIZE; i++) {
+        mask |= (uint32_t)(ctrl[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+void atom_map_init (mem_pool_t *pool, struct atom_map_t *map, uint32_t num_keys)
+{
+    *map = ZERO_INIT (struct atom_map_t);
+
+    // Keep the load factor at most 7/8.
+    uint32_t min_slots = num_keys + num_keys/7 + 1;
+    map->num_groups = 1;
+    while (map->num_groups*ATOM_MAP_GROUP_SIZE < min_slots) {
+        map->num_groups *= 2;
+    }
+
+    uint32_t num_slots = map->num_groups*ATOM_MAP_GROUP_SIZE;
+    map->ctrl = mem_pool_push_array (pool, num_slots, uint8_t);
+    map->keys = mem_pool_push_array (pool, num_slots, atom_t);
+    map->values = mem_pool_push_array (pool, num_slots, void*);
+    memset (map->ctrl, ATOM_MAP_EMPTY, num_slots);
+}
+
+static inline
+uint32_t atom_map_capacity (struct atom_map_t *map)
+{
+    return map->num_groups*ATOM_MAP_GROUP_SIZE;
+}
+
+// Returns a pointer to the value of atom, or to the slot where it should be
+// inserted if it's not in the map. In that case *found is set to false.
+void** atom_map_find_slot (struct atom_map_t *map, atom_t atom, bool *found)
+{
+    uint64_t h = atom_map_hash (atom);
+    uint8_t tag = h & 0x7F;
+    uint32_t mask = map->num_groups - 1;
+    uint32_t group = (h >> 7) & mask;
+
+    for (uint32_t i=1; i<=map->num_groups; i++) {
+        uint8_t *ctrl = map->ctrl + group*ATOM_MAP_GROUP_SIZE;
+
+        uint32_t matches = atom_map_group_match (ctrl, tag);
+        while (matches) {
+            uint32_t slot = group*ATOM_MAP_GROUP_SIZE + __builtin_ctz (matches);
+            if (map->keys[slot] == atom) {
+                *found = true;
+                return &map->values[slot];
+            }
+            matches &= matches - 1;
+        }
+
+        uint32_t empty = atom_map_group_match (ctrl, ATOM_MAP_EMPTY);
+        if (empty) {
+            *found = false;
+            return &map->values[group*ATOM_MAP_GROUP_SIZE + __builtin_ctz (empty)];
+        }
+
+        group = (group + i) & mask;
+    }
+
+    *found = false;
+    return NULL;
+}
+
+// Sets the value of atom, replacing the previous one if there was one. The map
+// must have been created with enough space for all keys.
+void atom_map_insert (struct atom_map_t *map, atom_t atom, void *value)
+{
+    assert (value != NULL);
+
+    bool found;
+    void **slot_value = atom_map_find_slot (map, atom, &found);
+    assert (slot_value != NULL && "Inserting into a full atom_map_t");
+
+    if (!found) {
+        uint32_t slot = slot_value - map->values;
+        map->ctrl[slot] = atom_map_hash (atom) & 0x7F;
+        map->keys[slot] = atom;
+        map->num_keys++;
+    }
+    *slot_value = value;
+}
+
+static inline
+void* atom_map_lookup (struct atom_map_t *map, atom_t atom)
+{
+    if (map->num_groups == 0) return NULL;
+
+    bool found;
+    void **slot_value = atom_map_find_slot (map, atom, &found);
+    return found ? *slot_value : NULL;
+}
+
+// Iterates all keys and values in the map, in no particular order:
+//
+//   uint32_t it = 0;
+//   atom_t key;
+//   void *value;
+//   while (atom_map_next (&map, &it, &key, &value)) {
+//       ...
+//   }
+bool atom_map_next (struct atom_map_t *map, uint32_t *it, atom_t *key, void **value)
+{
+    uint32_t capacity = atom_map_capacity (map);
+    while (*it < capacity) {
+        uint32_t slot = (*it)++;
+        if (map->ctrl[slot] != ATOM_MAP_EMPTY) {
+            *key = map->keys[slot];
+            *value = map->values[slot];
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Process wide table of interned icon names.
+//
+// Most icon names exist in many themes, and every theme used to keep its own
+// copy of each of them, then the All theme copied them once more. Instead,
+// each name is stored once here and identified by a 32 bit atom. Themes key
+// their icon_names maps by atom, and compare names by comparing atoms.
+//
+// Strings returned by atom_str() are stable for the lifetime of the table and
+// we call them atom strings. The atom is stored right before the string, so
+// atom_of_str() gets it back from an atom string without hashing. Don't call
+// it with any other string.
+//
+// Interning takes a lock, threads that intern many names should do it in a
+// single batch between atom_table_lock() and atom_table_unlock(), using
+// atom_intern_locked(). atom_str() doesn't lock, atoms are stored in fixed
+// blocks that never move. It's safe to call it from any thread that got the
+// atom after it was interned (through the lock, or a queue).
+//
+// Each atom also gets a sort key when it's interned, the case folded name, a
+// 0 byte and the name itself. Comparing keys bytewise orders names like
+// str_cmp_callback() does, AaBbCc and not ABCabc, but without calling
+// g_ascii_strcasecmp() and then g_strcmp0() for each comparison. Keys are what
+// atom_sort() radix sorts. Like atom strings, they never move, and the key's
+// length is stored right before it.
+
+typedef uint32_t atom_t;
+
+// Atom 0 is never handed out, so GUINT_TO_POINTER(atom) can be used as a key
+// in a GHashTable.
+#define ATOM_NULL 0
+
+#define ATOM_BLOCK_SHIFT 12
+#define ATOM_BLOCK_SIZE (1<<ATOM_BLOCK_SHIFT)
+#define ATOM_MAX_BLOCKS 4096
+
+struct atom_table_t {
+    GMutex mutex;
+    mem_pool_t pool;
+
+    // Maps atom strings to their atom.
+    GHashTable *atoms;
+
+    uint32_t num_atoms;
+    const char **blocks[ATOM_MAX_BLOCKS];
+    const uint8_t **sort_key_blocks[ATOM_MAX_BLOCKS];
+};
+
+void atom_table_init (struct atom_table_t *table)
+{
+    *table = ZERO_INIT (struct atom_table_t);
+    g_mutex_init (&table->mutex);
+    // A typical system has several thousand icon names, that's a few hundred
+    // KB of strings. They are looked up for as long as the application runs,
+    // so this is the one pool worth backing with huge pages.
+    table->pool.size_hint = 256*1024;
+    table->pool.use_huge_pages = true;
+    table->atoms = g_hash_table_new (g_str_hash, g_str_equal);
+    table->num_atoms = 1; // ATOM_NULL
+}
+
+void atom_table_destroy (struct atom_table_t *table)
+{
+    if (table->atoms == NULL) return;
+
+    g_hash_table_destroy (table->atoms);
+    g_mutex_clear (&table->mutex);
+    mem_pool_destroy (&table->pool);
+    *table = ZERO_INIT (struct atom_table_t);
+}
+
+static inline
+void atom_table_lock (struct atom_table_t *table)
+{
+    g_mutex_lock (&table->mutex);
+}
+
+static inline
+void atom_table_unlock (struct atom_table_t *table)
+{
+    g_mutex_unlock (&table->mutex);
+}
+
+static inline
+const char* atom_str (struct atom_table_t *table, atom_t atom)
+{
+    assert (atom != ATOM_NULL);
+    return table->blocks[atom >> ATOM_BLOCK_SHIFT][atom & (ATOM_BLOCK_SIZE-1)];
+}
+
+static inline
+const uint8_t* atom_sort_key (struct atom_table_t *table, atom_t atom, uint32_t *len)
+{
+    assert (atom != ATOM_NULL);
+    const uint8_t *key = table->sort_key_blocks[atom >> ATOM_BLOCK_SHIFT][atom & (ATOM_BLOCK_SIZE-1)];
+    memcpy (len, key - sizeof(uint32_t), sizeof(uint32_t));
+    return key;
+}
+
+static inline
+int atom_sort_key_cmp_n (const uint8_t *a, uint32_t a_len, const uint8_t *b, uint32_t b_len)
+{
+    int cmp = memcmp (a, b, MIN (a_len, b_len));
+    if (cmp == 0) {
+        cmp = (a_len > b_len) - (a_len < b_len);
+    }
+    return cmp;
+}
+
+// Orders atoms like str_cmp_callback() orders their strings.
+static inline
+int atom_sort_key_cmp (struct atom_table_t *table, atom_t a, atom_t b)
+{
+    if (a == b) return 0;
+
+    uint32_t a_len, b_len;
+    const uint8_t *a_key = atom_sort_key (table, a, &a_len);
+    const uint8_t *b_key = atom_sort_key (table, b, &b_len);
+    return atom_sort_key_cmp_n (a_key, a_len, b_key, b_len);
+}
+
+static inline
+atom_t atom_of_str (const char *atom_str)
+{
+    atom_t atom;
+    memcpy (&atom, atom_str - sizeof(atom_t), sizeof(atom_t));
+    return atom;
+}
+
+// Must be called between atom_table_lock() and atom_table_unlock().
+atom_t atom_intern_locked (struct atom_table_t *table, const char *str)
+{
+    gpointer atom;
+    if (g_hash_table_lookup_extended (table->atoms, str, NULL, &atom)) {
+        return GPOINTER_TO_UINT (atom);
+    }
+
+    atom_t new_atom = table->num_atoms;
+    uint32_t block = new_atom >> ATOM_BLOCK_SHIFT;
+    if (block >= ATOM_MAX_BLOCKS) {
+        printf ("Too many icon names, can't intern '%s'.\n", str);
+        return ATOM_NULL;
+    }
+
+    if (table->blocks[block] == NULL) {
+        table->blocks[block] = mem_pool_push_array (&table->pool, ATOM_BLOCK_SIZE, const char*);
+        table->sort_key_blocks[block] = mem_pool_push_array (&table->pool, ATOM_BLOCK_SIZE, const uint8_t*);
+    }
+
+    size_t len = strlen (str);
+    char *data = mem_pool_push_size (&table->pool, sizeof(atom_t) + len + 1);
+    memcpy (data, &new_atom, sizeof(atom_t));
+    char *new_str = data + sizeof(atom_t);
+    memcpy (new_str, str, len + 1);
+
+    uint32_t key_len = 2*len + 1;
+    uint8_t *key_data = mem_pool_push_size (&table->pool, sizeof(uint32_t) + key_len);
+    memcpy (key_data, &key_len, sizeof(uint32_t));
+    uint8_t *key = key_data + sizeof(uint32_t);
+    for (size_t i=0; i<len; i++) {
+        key[i] = g_ascii_tolower (str[i]);
+    }
+    key[len] = '\0';
+    memcpy (key + len + 1, str, len);
+
+    table->blocks[block][new_atom & (ATOM_BLOCK_SIZE-1)] = new_str;
+    table->sort_key_blocks[block][new_atom & (ATOM_BLOCK_SIZE-1)] = key;
+    g_hash_table_insert (table->atoms, new_str, GUINT_TO_POINTER (new_atom));
+    table->num_atoms++;
+    return new_atom;
+}
+
+atom_t atom_intern (struct atom_table_t *table, const char *str)
+{
+    atom_table_lock (table);
+    atom_t atom = atom_intern_locked (table, str);
+    atom_table_unlock (table);
+    return atom;
+}
+
+// Returns ATOM_NULL if str was never interned.
+atom_t atom_lookup (struct atom_table_t *table, const char *str)
+{
+    atom_table_lock (table);
+    gpointer atom = g_hash_table_lookup (table->atoms, str);
+    atom_table_unlock (table);
+    return GPOINTER_TO_UINT (atom);
+}
+
+struct atom_sort_entry_t {
+    const uint8_t *key;
+    uint32_t len;
+    atom_t atom;
+};
+
+#define ATOM_SORT_INSERTION_THRESHOLD 32
+
+// MSD radix sort of entries by the bytes of their keys from depth on, all
+// entries share the first depth bytes. There's one bucket per byte value, plus
+// bucket 0 for keys that end at depth, these are all equal. Small buckets are
+// finished with an insertion sort. tmp must have space for n entries.
+void atom_sort_entries (struct atom_sort_entry_t *entries, struct atom_sort_entry_t *tmp,
+                        uint32_t n, uint32_t depth)
+{
+    if (n < ATOM_SORT_INSERTION_THRESHOLD) {
+        for (uint32_t i=1; i<n; i++) {
+            struct atom_sort_entry_t e = entries[i];
+            uint32_t j = i;
+            while (j > 0 &&
+                   atom_sort_key_cmp_n (entries[j-1].key + depth, entries[j-1].len - depth,
+                                        e.key + depth, e.len - depth) > 0) {
+                entries[j] = entries[j-1];
+                j--;
+            }
+            entries[j] = e;
+        }
+        return;
+    }
+
+    uint32_t count[257] = {0};
+    for (uint32_t i=0; i<n; i++) {
+        uint32_t bucket = depth < entries[i].len ? entries[i].key[depth] + 1 : 0;
+        count[bucket]++;
+    }
+
+    uint32_t start[257];
+    uint32_t offset = 0;
+    for (int b=0; b<257; b++) {
+        start[b] = offset;
+        offset += count[b];
+    }
+
+    uint32_t pos[257];
+    memcpy (pos, start, sizeof(pos));
+    for (uint32_t i=0; i<n; i++) {
+        uint32_t bucket = depth < entries[i].len ? entries[i].key[depth] + 1 : 0;
+        tmp[pos[bucket]++] = entries[i];
+    }
+    memcpy (entries, tmp, n*sizeof(struct atom_sort_entry_t));
+
+    for (int b=1; b<257; b++) {
+        if (count[b] > 1) {
+            atom_sort_entries (entries + start[b], tmp + start[b], count[b], depth + 1);
+        }
+    }
+}
+
+// Sorts atoms by their sort key. Keys are gathered into a contiguous array
+// first, so the sort doesn't go through the block tables on each access.
+void atom_sort (struct atom_table_t *table, atom_t *atoms, uint32_t n)
+{
+    if (n < 2) return;
+
+    mem_pool_t pool = {0};
+    struct atom_sort_entry_t *entries = mem_pool_push_array (&pool, n, struct atom_sort_entry_t);
+    struct atom_sort_entry_t *tmp = mem_pool_push_array (&pool, n, struct atom_sort_entry_t);
+    for (uint32_t i=0; i<n; i++) {
+        entries[i].atom = atoms[i];
+        entries[i].key = atom_sort_key (table, atoms[i], &entries[i].len);
+    }
+
+    atom_sort_entries (entries, tmp, n, 0);
+
+    for (uint32_t i=0; i<n; i++) {
+        atoms[i] = entries[i].atom;
+    }
+    mem_pool_destroy (&pool);
+}
@@ -19,6 +19,9 @@
 #include <dirent.h>
 #include <locale.h>
 #include <float.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #ifdef __cplusplus
 #define ZERO_INIT(type) (type){}
@@ -1949,17 +1952,15 @@ typedef struct {
 void* cont_buff_push (cont_buff_t *buff, int size)
 {
     if (buff->used + size >= buff->size) {
+        uint32_t new_size = buff->size == 0 ? MAX (CONT_BUFF_MIN_SIZE, buff->min_size) : 2*buff->size;
+        while (buff->used + size >= new_size) {
+            new_size *= 2;
+        }
+
         void *new_data;
-        if (buff->size == 0) {
-            int new_size = MAX (CONT_BUFF_MIN_SIZE, buff->min_size);
-            if ((buff->data = malloc (new_size))) {
-                buff->size = new_size;
-            } else {
-                printf ("Malloc failed.\n");
-            }
-        } else if ((new_data = realloc (buff->data, 2*buff->size))) {
+        if ((new_data = realloc (buff->data, new_size))) {
             buff->data = new_data;
-            buff->size = 2*buff->size;
+            buff->size = new_size;
         } else {
             printf ("Error: Realloc failed.\n");
             return NULL;
@@ -1981,9 +1982,25 @@ void cont_buff_destroy (cont_buff_t *buff)
 }
 
 // Memory pool that grows as needed, and can be freed easily.
+//
+// Each new bin is twice as big as the previous one, up to
+// MEM_POOL_MAX_GROWTH_BIN_SIZE, so a pool that ends up holding n bytes only
+// calls malloc() O(log n) times. Bins are never smaller than min_bin_size, and
+// the first one is at least size_hint bytes, set it when the final size of the
+// pool can be estimated.
+//
+// If use_huge_pages is set, new bins are allocated with mmap() in multiples of
+// MEM_POOL_HUGE_PAGE_SIZE, and transparent huge pages are requested for them.
+// It's only worth it for big pools that live long or are reused, because each
+// bin takes at least 2MB.
 #define MEM_POOL_DEFAULT_MIN_BIN_SIZE 1024u
+#define MEM_POOL_MAX_GROWTH_BIN_SIZE (1024u*1024u)
+#define MEM_POOL_HUGE_PAGE_SIZE (2u*1024u*1024u)
 typedef struct {
     uint32_t min_bin_size;
+    uint32_t size_hint;
+    bool use_huge_pages;
+
     uint32_t size;
     uint32_t used;
     void *base;
@@ -1993,6 +2010,17 @@ typedef struct {
     // ammount of empty space left in previous bins.
     uint32_t total_data;
     uint32_t num_bins;
+
+    // Bins kept by mem_pool_reset(), they are reused before allocating new
+    // ones. Linked through their prev_bin_info.
+    struct _bin_info_t *free_bins;
+
+    // Statistics, printed by mem_pool_print(). Bytes held in bins (including
+    // free ones), the maximum it ever reached, and how many bins were
+    // allocated over the lifetime of the pool.
+    uint64_t allocated;
+    uint64_t peak_allocated;
+    uint32_t num_bin_allocations;
 } mem_pool_t;
 
 // Sometimes we want to execute code when something we allocated in a pool gets
@@ -2033,6 +2061,7 @@ struct on_destroy_callback_info_t {
 struct _bin_info_t {
     void *base;
     uint32_t size;
+    bool is_mmapped;
     struct _bin_info_t *prev_bin_info;
 
     struct on_destroy_callback_info_t *last_cb_info;
@@ -2087,14 +2116,57 @@ void* mem_pool_push_size_full (mem_pool_t *pool, uint32_t size, enum alloc_opts
             pool->min_bin_size = MEM_POOL_DEFAULT_MIN_BIN_SIZE;
         }
 
-        int new_bin_size = MAX(pool->min_bin_size, required_size);
-        void *new_bin;
+        uint32_t new_bin_size = MAX(pool->min_bin_size, required_size);
+        if (pool->base == NULL) {
+            new_bin_size = MAX(new_bin_size, pool->size_hint);
+        } else {
+            new_bin_size = MAX(new_bin_size, MIN(2*pool->size, MEM_POOL_MAX_GROWTH_BIN_SIZE));
+        }
+
+        void *new_bin = NULL;
         bin_info_t *new_info;
-        if ((new_bin = malloc (new_bin_size + sizeof(bin_info_t)))) {
-            new_info = (bin_info_t*)((uint8_t*)new_bin + new_bin_size);
+
+        // Reuse the first bin kept by mem_pool_reset() that is large enough.
+        bin_info_t **free_bin = &pool->free_bins;
+        while (*free_bin != NULL && (*free_bin)->size < required_size) {
+            free_bin = &(*free_bin)->prev_bin_info;
+        }
+
+        if (*free_bin != NULL) {
+            new_info = *free_bin;
+            *free_bin = new_info->prev_bin_info;
+            new_bin = new_info->base;
+            new_bin_size = new_info->size;
+
         } else {
-            printf ("Malloc failed.\n");
-            return NULL;
+            bool is_mmapped = false;
+            if (pool->use_huge_pages) {
+                uint64_t mapping_size = ((uint64_t)new_bin_size + sizeof(bin_info_t) + MEM_POOL_HUGE_PAGE_SIZE - 1)
+                                        & ~((uint64_t)MEM_POOL_HUGE_PAGE_SIZE - 1);
+                new_bin = mmap (NULL, mapping_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+                if (new_bin != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+                    madvise (new_bin, mapping_size, MADV_HUGEPAGE);
+#endif
+                    new_bin_size = mapping_size - sizeof(bin_info_t);
+                    is_mmapped = true;
+                } else {
+                    // Fall back to malloc().
+                    new_bin = NULL;
+                }
+            }
+
+            if (new_bin == NULL && (new_bin = malloc (new_bin_size + sizeof(bin_info_t))) == NULL) {
+                printf ("Malloc failed.\n");
+                return NULL;
+            }
+
+            new_info = (bin_info_t*)((uint8_t*)new_bin + new_bin_size);
+            new_info->is_mmapped = is_mmapped;
+
+            pool->num_bin_allocations++;
+            pool->allocated += new_bin_size + sizeof(bin_info_t);
+            pool->peak_allocated = MAX (pool->peak_allocated, pool->allocated);
         }
 
         new_info->base = new_bin;
@@ -2135,11 +2207,28 @@ void* mem_pool_push_size_full (mem_pool_t *pool, uint32_t size, enum alloc_opts
     return ret;
 }
 
+void _mem_pool_bin_free (bin_info_t *bin_info)
+{
+    if (bin_info->is_mmapped) {
+        munmap (bin_info->base, bin_info->size + sizeof(bin_info_t));
+    } else {
+        free (bin_info->base);
+    }
+}
+
 // NOTE: Do NOT use _pool_ again after calling this. We don't reset pool because
 // it could have been bootstrapped into itself. Reusing is better hendled by
 // mem_pool_end_temporary_memory().
 void mem_pool_destroy (mem_pool_t *pool)
 {
+    // NOTE: Free bins go first, the pool may be bootstrapped into one of the
+    // bins in use.
+    while (pool->free_bins != NULL) {
+        bin_info_t *to_free = pool->free_bins;
+        pool->free_bins = pool->free_bins->prev_bin_info;
+        _mem_pool_bin_free (to_free);
+    }
+
     if (pool->base != NULL) {
         bin_info_t *curr_info = (bin_info_t*)((uint8_t*)pool->base + pool->size);
 
@@ -2154,16 +2243,14 @@ void mem_pool_destroy (mem_pool_t *pool)
             curr_info = curr_info->prev_bin_info;
         }
 
-        // Free all allocated bins
+        // Free all allocated bins. The bin info is at the end of each bin, get
+        // the previous one before freeing it.
         curr_info = (bin_info_t*)((uint8_t*)pool->base + pool->size);
-        void *to_free = curr_info->base;
-        curr_info = curr_info->prev_bin_info;
         while (curr_info != NULL) {
-            free (to_free);
-            to_free = curr_info->base;
+            bin_info_t *to_free = curr_info;
             curr_info = curr_info->prev_bin_info;
+            _mem_pool_bin_free (to_free);
         }
-        free (to_free);
     }
 }
 
@@ -2231,7 +2318,8 @@ void mem_pool_print (mem_pool_t *pool)
         left_empty = 0;
     }
     printf ("Left empty: %lu bytes (%.2f%%)\n", left_empty, ((double)left_empty*100)/allocated);
-    printf ("Bins: %u\n", pool->num_bins);
+    printf ("Bins: %u (%u allocated over the pool's lifetime)\n", pool->num_bins, pool->num_bin_allocations);
+    printf ("Peak: %lu bytes\n", pool->peak_allocated);
 }
 
 typedef struct {
@@ -2251,7 +2339,9 @@ mem_pool_marker_t mem_pool_begin_temporary_memory (mem_pool_t *pool)
     return res;
 }
 
-void mem_pool_end_temporary_memory (mem_pool_marker_t mrkr)
+// Rewinds the pool to mrkr. Bins allocated after it are freed, or if keep_bins
+// is true, they are kept in pool->free_bins to be reused by later allocations.
+void _mem_pool_rewind (mem_pool_marker_t mrkr, bool keep_bins)
 {
     if (mrkr.base != NULL) {
         // Call all on_destroy callbacks for bins that will be freed, starting
@@ -2283,9 +2373,16 @@ void mem_pool_end_temporary_memory (mem_pool_marker_t mrkr)
         // Free necessary bins
         curr_info = (bin_info_t*)((uint8_t*)mrkr.pool->base + mrkr.pool->size);
         while (curr_info->base != mrkr.base) {
-            void *to_free = curr_info->base;
+            bin_info_t *to_free = curr_info;
             curr_info = curr_info->prev_bin_info;
-            free (to_free);
+            if (keep_bins) {
+                to_free->last_cb_info = NULL;
+                to_free->prev_bin_info = mrkr.pool->free_bins;
+                mrkr.pool->free_bins = to_free;
+            } else {
+                mrkr.pool->allocated -= to_free->size + sizeof(bin_info_t);
+                _mem_pool_bin_free (to_free);
+            }
             mrkr.pool->num_bins--;
         }
         mrkr.pool->size = curr_info->size;
@@ -2303,9 +2400,39 @@ void mem_pool_end_temporary_memory (mem_pool_marker_t mrkr)
         mrkr.pool->base = NULL;
         mrkr.pool->used = 0;
         mrkr.pool->total_data = 0;
+        mrkr.pool->num_bins = 0;
+        mrkr.pool->allocated = 0;
     }
 }
 
+void mem_pool_end_temporary_memory (mem_pool_marker_t mrkr)
+{
+    _mem_pool_rewind (mrkr, false);
+}
+
+// Frees everything allocated in the pool, calling all on_destroy callbacks,
+// but keeps its bins so they are reused by future allocations instead of
+// calling malloc() again. Use this for pools that are filled and emptied
+// over and over.
+//
+// NOTE: Don't use this on a pool that was bootstrapped into itself.
+void mem_pool_reset (mem_pool_t *pool)
+{
+    if (pool->base == NULL) return;
+
+    bin_info_t *first_info = (bin_info_t*)((uint8_t*)pool->base + pool->size);
+    while (first_info->prev_bin_info != NULL) {
+        first_info = first_info->prev_bin_info;
+    }
+
+    mem_pool_marker_t mrkr;
+    mrkr.pool = pool;
+    mrkr.base = first_info->base;
+    mrkr.used = 0;
+    mrkr.total_data = 0;
+    _mem_pool_rewind (mrkr, true);
+}
+
 // The idea of this is to allow chaining multiple pools so we only need to
 // delete the parent one.
 ON_DESTROY_CALLBACK(pool_chain_destroy)
@@ -2315,6 +2442,78 @@ ON_DESTROY_CALLBACK(pool_chain_destroy)
 
 #define mem_pool_add_child(pool,child_pool) mem_pool_push_cb(pool, pool_chain_destroy, child_pool)
 
+// Moves everything allocated in child into parent without copying it. After
+// this child is empty and can be used again. What was allocated in it stays
+// valid until parent is destroyed, or rewound to a marker taken before the
+// adoption.
+//
+// This is how work done in other threads changes owner. Pools aren't thread
+// safe, so each worker allocates in a pool nobody else touches, without
+// locking, then hands it to the thread that owns parent, which adopts it:
+//
+//   // In a worker, job->pool starts zeroed.
+//   job->result = compute (&job->pool, job->input);
+//   g_async_queue_push (done, job);
+//
+//   // In the thread that owns parent.
+//   while ((job = g_async_queue_try_pop (done)) != NULL) {
+//       mem_pool_adopt (&parent, &job->pool);
+//       use (job->result);
+//   }
+//   ...
+//   mem_pool_destroy (&parent); // Frees the results of all jobs.
+//
+// NOTE: Only the thread that owns parent can call this, and child must not be
+// in use by any other thread.
+void mem_pool_adopt (mem_pool_t *parent, mem_pool_t *child)
+{
+    if (child->base == NULL && child->free_bins == NULL) return;
+
+    mem_pool_t *adopted = mem_pool_push_struct (parent, mem_pool_t);
+    *adopted = *child;
+    mem_pool_add_child (parent, adopted);
+
+    mem_pool_t config = *child;
+    *child = ZERO_INIT (mem_pool_t);
+    child->min_bin_size = config.min_bin_size;
+    child->size_hint = config.size_hint;
+    child->use_huge_pages = config.use_huge_pages;
+}
+
+// Returns a pool that belongs to the calling thread, for scratch memory of
+// code that runs in worker threads. It's created the first time a thread asks
+// for it, and destroyed when the thread exits. Use mem_pool_reset() to free
+// what was allocated in it while keeping its bins for the next job the thread
+// runs. Its contents can also be handed to another thread with
+// mem_pool_adopt().
+//
+// NOTE: The pool of the main thread is never destroyed.
+static pthread_key_t _mem_pool_thread_local_key;
+static pthread_once_t _mem_pool_thread_local_once = PTHREAD_ONCE_INIT;
+
+void _mem_pool_thread_local_destroy (void *pool)
+{
+    mem_pool_destroy (pool);
+    free (pool);
+}
+
+void _mem_pool_thread_local_key_create (void)
+{
+    pthread_key_create (&_mem_pool_thread_local_key, _mem_pool_thread_local_destroy);
+}
+
+mem_pool_t* mem_pool_thread_local (void)
+{
+    pthread_once (&_mem_pool_thread_local_once, _mem_pool_thread_local_key_create);
+
+    mem_pool_t *pool = pthread_getspecific (_mem_pool_thread_local_key);
+    if (pool == NULL) {
+        pool = calloc (1, sizeof(mem_pool_t));
+        pthread_setspecific (_mem_pool_thread_local_key, pool);
+    }
+    return pool;
+}
+
 // pom == pool or malloc
 #define pom_push_struct(pool, type) pom_push_size(pool, sizeof(type))
 #define pom_push_array(pool, n, type) pom_push_size(pool, (n)*sizeof(type))
@@ -2748,6 +2947,252 @@ bool read_dir (DIR *dirp, struct dirent **res)
     return true;
 }
 
+// Type of an entry returned by read_dir(), as the S_IFMT bits of st_mode or 0
+// if it can't be determined. Most filesystems fill d_type, in that case no
+// syscall is made. Only when the type is unknown, or the entry is a symlink
+// (which we follow), fstatat() is called relative to dir_fd. Use dirfd() to
+// get it from a DIR*.
+static inline
+mode_t dir_entry_type (int dir_fd, struct dirent *entry)
+{
+    if (entry->d_type == DT_REG) {
+        return S_IFREG;
+
+    } else if (entry->d_type == DT_DIR) {
+        return S_IFDIR;
+
+    } else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+        struct stat st;
+        if (fstatat (dir_fd, entry->d_name, &st, 0) == 0) {
+            return st.st_mode & S_IFMT;
+        }
+        return 0;
+
+    } else {
+        return DTTOIF (entry->d_type);
+    }
+}
+
+#define dir_entry_is_reg(dir_fd,entry) (dir_entry_type(dir_fd,entry) == S_IFREG)
+#define dir_entry_is_dir(dir_fd,entry) (dir_entry_type(dir_fd,entry) == S_IFDIR)
+
+// Checks if path exists relative to dir_fd, without reading the directory or
+// filling a struct stat.
+static inline
+bool file_exists_at (int dir_fd, const char *path)
+{
+    return faccessat (dir_fd, path, F_OK, 0) == 0;
+}
+
+/////////////////////
+// Path builder
+//
+// Fixed capacity buffer to build paths without allocating, meant to be kept in
+// the stack by loops that visit many files below the same directory. Pushing a
+// component adds a '/' before it if the path doesn't end with one already, so
+// pushing an empty component just adds a trailing '/'. To pop components,
+// remember the length before pushing them and truncate back to it:
+//
+//   struct path_builder_t path;
+//   path_builder_set (&path, theme_dir);
+//   path_builder_push (&path, "");
+//   uint32_t theme_dir_len = path.len;
+//   for (...) {
+//       path_builder_truncate (&path, theme_dir_len);
+//       path_builder_push (&path, section_name);
+//       ... use path.str ...
+//   }
+//
+// If the result doesn't fit in PATH_MAX bytes, the path is left unchanged and
+// false is returned. Paths that long can't be opened anyway.
+struct path_builder_t {
+    uint32_t len;
+    char str[PATH_MAX];
+};
+
+static inline
+void path_builder_truncate (struct path_builder_t *path, uint32_t len)
+{
+    assert (len <= path->len);
+    path->len = len;
+    path->str[len] = '\0';
+}
+
+bool path_builder_push_n (struct path_builder_t *path, const char *component, size_t len)
+{
+    bool needs_separator = path->len > 0 && path->str[path->len-1] != '/';
+    size_t new_len = path->len + (needs_separator ? 1 : 0) + len;
+    if (new_len >= ARRAY_SIZE(path->str)) {
+        return false;
+    }
+
+    if (needs_separator) {
+        path->str[path->len++] = '/';
+    }
+    memcpy (path->str + path->len, component, len);
+    path->len = new_len;
+    path->str[new_len] = '\0';
+    return true;
+}
+
+static inline
+bool path_builder_push (struct path_builder_t *path, const char *component)
+{
+    return path_builder_push_n (path, component, strlen (component));
+}
+
+static inline
+bool path_builder_set (struct path_builder_t *path, const char *str)
+{
+    path->len = 0;
+    path->str[0] = '\0';
+    return path_builder_push (path, str);
+}
+
+/////////////////////
+// Directory reader
+//
+// Alternative to opendir()/readdir() with a choice of backend. With
+// DIR_READER_GETDENTS the directory is read with getdents64() into a large
+// buffer owned by the reader, so most directories are read with a single
+// syscall, instead of the 32KB chunks used by readdir(). The buffer is kept
+// across dir_reader_open() calls, so the same reader can be reused to read
+// many directories without allocating.
+//
+//   struct dir_reader_t reader = {0};
+//   if (dir_reader_open (&reader, path, DIR_READER_GETDENTS)) {
+//       struct dirent *entry_info;
+//       while (dir_reader_next (&reader, &entry_info)) {
+//           mode_t type = dir_entry_type (dir_reader_fd (&reader), entry_info);
+//           ...
+//       }
+//       dir_reader_close (&reader);
+//   }
+//   dir_reader_destroy (&reader);
+//
+// NOTE: The records returned by getdents64() have the same layout as struct
+// dirent in Linux (when off_t is 64 bits), glibc's readdir() also returns
+// pointers into them. glibc tells us if this holds with
+// _DIRENT_MATCHES_DIRENT64, if it doesn't (like 32 bit builds without
+// _FILE_OFFSET_BITS=64) or we can't tell, DIR_READER_GETDENTS falls back to
+// readdir(). The offsets are also checked against the record layout
+// documented in getdents(2).
+#include <sys/syscall.h>
+#include <stddef.h>
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+#if defined(__linux__) && defined(SYS_getdents64) && \
+    defined(_DIRENT_MATCHES_DIRENT64) && _DIRENT_MATCHES_DIRENT64
+#define DIR_READER_HAS_GETDENTS
+
+_Static_assert (offsetof(struct dirent, d_reclen) == offsetof(struct linux_dirent64, d_reclen) &&
+                offsetof(struct dirent, d_type) == offsetof(struct linux_dirent64, d_type) &&
+                offsetof(struct dirent, d_name) == offsetof(struct linux_dirent64, d_name),
+                "struct dirent doesn't match the layout of getdents64() records");
+#endif
+
+enum dir_reader_backend_t {
+    DIR_READER_READDIR,
+    DIR_READER_GETDENTS
+};
+
+// NOTE: Keep this below glibc's mmap threshold (128KB), otherwise each buffer
+// allocation is an mmap() and munmap() pair.
+#define DIR_READER_BUFF_SIZE (64*1024)
+
+struct dir_reader_t {
+    enum dir_reader_backend_t backend;
+    DIR *d;
+    int fd;
+
+    char *buff;
+    size_t buff_len;
+    size_t pos;
+};
+
+bool dir_reader_open (struct dir_reader_t *reader, const char *path, enum dir_reader_backend_t backend)
+{
+#ifndef DIR_READER_HAS_GETDENTS
+    backend = DIR_READER_READDIR;
+#endif
+
+    reader->backend = backend;
+    if (backend == DIR_READER_READDIR) {
+        reader->d = opendir (path);
+        if (reader->d == NULL) return false;
+        reader->fd = dirfd (reader->d);
+
+    } else {
+        reader->fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (reader->fd == -1) return false;
+
+        if (reader->buff == NULL) {
+            reader->buff = malloc (DIR_READER_BUFF_SIZE);
+        }
+        reader->buff_len = 0;
+        reader->pos = 0;
+    }
+    return true;
+}
+
+static inline
+int dir_reader_fd (struct dir_reader_t *reader)
+{
+    return reader->fd;
+}
+
+// Same as read_dir() but from a reader opened with dir_reader_open().
+bool dir_reader_next (struct dir_reader_t *reader, struct dirent **res)
+{
+    if (reader->backend == DIR_READER_READDIR) {
+        return read_dir (reader->d, res);
+    }
+
+#ifdef DIR_READER_HAS_GETDENTS
+    if (reader->pos >= reader->buff_len) {
+        long len = syscall (SYS_getdents64, reader->fd, reader->buff, DIR_READER_BUFF_SIZE);
+        if (len <= 0) {
+            if (len == -1) {
+                printf ("Error while reading directory: %s\n", strerror (errno));
+            }
+            return false;
+        }
+        reader->buff_len = len;
+        reader->pos = 0;
+    }
+
+    *res = (struct dirent*)(reader->buff + reader->pos);
+    reader->pos += (*res)->d_reclen;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void dir_reader_close (struct dir_reader_t *reader)
+{
+    if (reader->backend == DIR_READER_READDIR) {
+        closedir (reader->d);
+        reader->d = NULL;
+    } else {
+        close (reader->fd);
+    }
+    reader->fd = -1;
+}
+
+void dir_reader_destroy (struct dir_reader_t *reader)
+{
+    free (reader->buff);
+    *reader = ZERO_INIT (struct dir_reader_t);
+}
+
 ////////////////////////////
 // Recursive folder iterator
 //
@@ -2775,43 +3220,76 @@ ITERATE_DIR_CB (iterate_dir_printf)
     printf ("%s\n", fname);
 }
 
-void iterate_dir_helper (string_t *path,  iterate_dir_cb_t *callback, void *data)
+// A directory being read can't share its reader with its subdirectories, so
+// there is one reader for each depth. They are created the first time that
+// depth is reached and reused for all directories at the same depth, then the
+// number of buffers allocated is the depth of the tree, not the number of
+// directories in it.
+struct iterate_dir_reader_t {
+    struct dir_reader_t reader;
+    struct iterate_dir_reader_t *next;
+};
+
+void iterate_dir_helper (mem_pool_t *pool, struct iterate_dir_reader_t *level,
+                         string_t *path, enum dir_reader_backend_t backend,
+                         iterate_dir_cb_t *callback, void *data)
 {
     int path_len = str_len (path);
 
-    struct stat st;
     callback (str_data(path), true, data);
-    DIR *d = opendir (str_data(path));
+    struct dir_reader_t *reader = &level->reader;
+    if (!dir_reader_open (reader, str_data(path), backend)) {
+        return;
+    }
+
     struct dirent *entry_info;
-    while (read_dir (d, &entry_info)) {
+    while (dir_reader_next (reader, &entry_info)) {
         if (entry_info->d_name[0] != '.') { // file is not hidden
-            str_put_c (path, path_len, entry_info->d_name);
-            if (stat(str_data(path), &st) == 0) {
-                if (S_ISREG(st.st_mode)) {
-                    callback (str_data(path), false, data);
-
-                } else if (S_ISDIR(st.st_mode)) {
-                    str_cat_c (path, "/");
-                    iterate_dir_helper (path, callback, data);
+            mode_t type = dir_entry_type (dir_reader_fd(reader), entry_info);
+            if (type == S_IFREG) {
+                str_put_c (path, path_len, entry_info->d_name);
+                callback (str_data(path), false, data);
+
+            } else if (type == S_IFDIR) {
+                str_put_c (path, path_len, entry_info->d_name);
+                str_cat_c (path, "/");
+
+                if (level->next == NULL) {
+                    level->next = mem_pool_push_struct (pool, struct iterate_dir_reader_t);
+                    *level->next = ZERO_INIT (struct iterate_dir_reader_t);
                 }
+                iterate_dir_helper (pool, level->next, path, backend, callback, data);
             }
         }
     }
-    closedir (d);
+    dir_reader_close (reader);
 }
 
-void iterate_dir (char *path, iterate_dir_cb_t *callback, void *data)
+void iterate_dir_backend (char *path, enum dir_reader_backend_t backend,
+                          iterate_dir_cb_t *callback, void *data)
 {
     string_t path_str = str_new (path);
     if (str_last (&path_str) != '/') {
         str_cat_c (&path_str, "/");
     }
 
-    iterate_dir_helper (&path_str, callback, data);
+    mem_pool_t pool = {0};
+    struct iterate_dir_reader_t levels = {0};
+    iterate_dir_helper (&pool, &levels, &path_str, backend, callback, data);
+
+    for (struct iterate_dir_reader_t *level = &levels; level != NULL; level = level->next) {
+        dir_reader_destroy (&level->reader);
+    }
+    mem_pool_destroy (&pool);
 
     str_free (&path_str);
 }
 
+void iterate_dir (char *path, iterate_dir_cb_t *callback, void *data)
+{
+    iterate_dir_backend (path, DIR_READER_READDIR, callback, data);
+}
+
 //////////////////////////////
 //
 // PATH/FILENAME MANIPULATIONS
@@ -66,6 +66,8 @@ struct fk_list_box_t {
 
     // Number of rows that have been created
     int row_cnt;
+    // Number of rows allocated in rows and visible_rows
+    int rows_capacity;
 };
 
 gboolean fk_list_box_draw_text_data (GtkWidget *widget, cairo_t *cr, gpointer data)
@@ -113,7 +115,7 @@ gboolean fk_list_box_draw_text_data (GtkWidget *widget, cairo_t *cr, gpointer da
 
     gtk_widget_set_size_request (widget, width, y);
 
-    if (!fk_list_box->selected_row->hidden) {
+    if (fk_list_box->selected_row != NULL && !fk_list_box->selected_row->hidden) {
         assert (fk_list_box->selected_row_idx != -1);
 
         gboolean has_focus = gtk_widget_has_focus (widget);
@@ -140,19 +142,27 @@ gboolean fk_list_box_draw_text_data (GtkWidget *widget, cairo_t *cr, gpointer da
     return TRUE;
 }
 
+// Starts adding num_rows rows with fk_list_box_row_new(), this replaces all
+// existing rows. It can be called again on the same fk_list_box_t to rebuild the
+// rows of a list that grows, the arrays are only reallocated if num_rows
+// doesn't fit and then they grow geometrically.
 void fk_list_box_rows_start (struct fk_list_box_t *fk_list_box, int num_rows)
 {
+    if (num_rows > fk_list_box->rows_capacity) {
+        fk_list_box->rows_capacity = MAX(num_rows, 2*fk_list_box->rows_capacity);
+        fk_list_box->rows =
+            mem_pool_push_size (&fk_list_box->pool,
+                                fk_list_box->rows_capacity*sizeof(struct fk_list_box_row_t));
+        fk_list_box->visible_rows =
+            mem_pool_push_size (&fk_list_box->pool,
+                                fk_list_box->rows_capacity*sizeof(struct fk_list_box_row_t*));
+    }
+
     fk_list_box->row_cnt = 0;
     fk_list_box->num_rows = num_rows;
     fk_list_box->num_visible_rows = num_rows;
-    fk_list_box->rows =
-        mem_pool_push_size (&fk_list_box->pool,
-                            fk_list_box->num_rows*sizeof(struct fk_list_box_row_t));
-    fk_list_box->visible_rows =
-        mem_pool_push_size (&fk_list_box->pool,
-                            fk_list_box->num_rows*sizeof(struct fk_list_box_row_t*));
     fk_list_box->selected_row_idx = 0;
-    fk_list_box->selected_row = &fk_list_box->rows[0];
+    fk_list_box->selected_row = num_rows > 0 ? &fk_list_box->rows[0] : NULL;
 }
 
 struct fk_list_box_row_t* fk_list_box_row_new (struct fk_list_box_t *fk_list_box)
@@ -182,7 +192,7 @@ void fk_list_box_refresh_hidden (struct fk_list_box_t *fk_list_box)
     }
     fk_list_box->num_visible_rows = visible_cnt;
 
-    if (!fk_list_box->selected_row->hidden &&
+    if (fk_list_box->selected_row != NULL && !fk_list_box->selected_row->hidden &&
         fk_list_box->selected_row != fk_list_box->visible_rows[fk_list_box->selected_row_idx]) {
         // The selected row is visible and its index changed, compute the new one.
         // TODO: We can speed this up with binary search of pointers, as rows
@@ -219,6 +229,20 @@ void fk_list_box_set_selected (struct fk_list_box_t *fk_list_box, int idx)
     }
 }
 
+// Selects the visible row with the passed data pointer, if there is one. Like
+// fk_list_box_set_selected() the callback is not called. Returns false if no
+// visible row has this data.
+bool fk_list_box_set_selected_data (struct fk_list_box_t *fk_list_box, void *data)
+{
+    for (int i=0; i<fk_list_box->num_visible_rows; i++) {
+        if (fk_list_box->visible_rows[i]->data == data) {
+            fk_list_box_set_selected (fk_list_box, i);
+            return true;
+        }
+    }
+    return false;
+}
+
 // NOTE: idx is the index of the selected row in the visible_rows array.
 void fk_list_box_change_selected (struct fk_list_box_t *fk_list_box, int idx)
 {
@@ -245,6 +269,10 @@ gboolean fk_list_box_button_release (GtkWidget *widget, GdkEvent *event, gpointe
 gboolean fk_list_box_key_press (GtkWidget *widget, GdkEventKey *e, gpointer data)
 {
     struct fk_list_box_t *fk_list_box = (struct fk_list_box_t *)data;
+    if (fk_list_box->num_visible_rows == 0) {
+        return FALSE;
+    }
+
     int idx = -1;
     if (e->keyval == GDK_KEY_Up || e->keyval == GDK_KEY_KP_Up) {
         idx = MAX(0, fk_list_box->selected_row_idx-1);
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Reader for the icon-theme.cache files created by gtk-update-icon-cache.
+//
+// Most installed themes ship one of these at the root of each theme directory.
+// It contains a hash table of all icon names in the theme, and for each one the
+// list of directories where an image for it exists together with the
+// extensions found. Reading it is a lot faster than walking all directories of
+// a theme, so we use it whenever it's up to date.
+//
+// The file is mmap'd and nothing is copied out of it. All returned strings
+// point into the mapped file and are null terminated. The mapping lives as long
+// as the pool passed to gtk_icon_cache_map().
+//
+// The format is (all integers are big endian, offsets are from the start of
+// the file):
+//
+//   Header:
+//      u16 major_version (1)
+//      u16 minor_version (0)
+//      u32 hash_offset
+//      u32 directory_list_offset
+//
+//   DirectoryList:
+//      u32 n_directories
+//      u32 directory_offset[n_directories]  -> null terminated string
+//
+//   Hash:
+//      u32 n_buckets
+//      u32 icon_offset[n_buckets]           -> Icon, 0xFFFFFFFF if empty
+//
+//   Icon:
+//      u32 chain_offset                     -> Icon, 0xFFFFFFFF at the end
+//      u32 name_offset                      -> null terminated string
+//      u32 image_list_offset                -> ImageList
+//
+//   ImageList:
+//      u32 n_images
+//      Image images[n_images]
+//
+//   Image:
+//      u16 directory_index
+//      u16 flags
+//      u32 image_data_offset
+//
+// NOTE: The icon name stored is the file name up to the last '.', so an image
+// named foo.symbolic.png is stored as "foo.symbolic" with the PNG flag set.
+
+#include <sys/mman.h>
+
+#define GTK_ICON_CACHE_HAS_SUFFIX_XPM 0x01
+#define GTK_ICON_CACHE_HAS_SUFFIX_SVG 0x02
+#define GTK_ICON_CACHE_HAS_SUFFIX_PNG 0x04
+#define GTK_ICON_CACHE_HAS_ICON_FILE  0x08
+
+#define GTK_ICON_CACHE_END 0xFFFFFFFF
+
+struct gtk_icon_cache_t {
+    uint8_t *data;
+    uint32_t size;
+
+    uint32_t num_dirs;
+    uint32_t dir_list_offset;
+    uint32_t num_buckets;
+    uint32_t hash_offset;
+};
+
+static inline
+bool gtk_icon_cache_u16 (struct gtk_icon_cache_t *cache, uint32_t offset, uint16_t *res)
+{
+    if (offset > cache->size - 2) return false;
+    *res = (uint16_t)cache->data[offset] << 8 | cache->data[offset+1];
+    return true;
+}
+
+static inline
+bool gtk_icon_cache_u32 (struct gtk_icon_cache_t *cache, uint32_t offset, uint32_t *res)
+{
+    if (offset > cache->size - 4) return false;
+    *res = (uint32_t)cache->data[offset] << 24 | (uint32_t)cache->data[offset+1] << 16 |
+           (uint32_t)cache->data[offset+2] << 8 | cache->data[offset+3];
+    return true;
+}
+
+// Returns a pointer to the null terminated string at offset, or NULL if the
+// string is not completely inside the file.
+static inline
+char* gtk_icon_cache_str (struct gtk_icon_cache_t *cache, uint32_t offset)
+{
+    if (offset >= cache->size) return NULL;
+
+    char *str = (char*)cache->data + offset;
+    if (memchr (str, '\0', cache->size - offset) == NULL) return NULL;
+    return str;
+}
+
+// Returns the name of the directory at index idx of the directory list,
+// relative to the theme directory.
+char* gtk_icon_cache_dir_name (struct gtk_icon_cache_t *cache, uint32_t idx)
+{
+    uint32_t dir_offset;
+    if (idx < cache->num_dirs &&
+        gtk_icon_cache_u32 (cache, cache->dir_list_offset + 4 + 4*idx, &dir_offset)) {
+        return gtk_icon_cache_str (cache, dir_offset);
+    }
+    return NULL;
+}
+
+struct gtk_icon_cache_unmap_clsr_t {
+    void *data;
+    size_t size;
+};
+
+ON_DESTROY_CALLBACK (gtk_icon_cache_unmap)
+{
+    struct gtk_icon_cache_unmap_clsr_t *info = (struct gtk_icon_cache_unmap_clsr_t*)allocated;
+    munmap (info->data, info->size);
+}
+
+static inline
+bool gtk_icon_cache_is_stale (struct stat *cache_st, char *path)
+{
+    struct stat st;
+    if (stat (path, &st) == 0) {
+        return st.st_mtime > cache_st->st_mtime;
+    } else {
+        // A directory that was deleted after the cache was created.
+        return errno == ENOENT;
+    }
+}
+
+// Maps the icon-theme.cache file inside theme_dir. Returns false if there is no
+// cache, it can't be read, or it's older than the theme directory or any of the
+// directories listed in it. The mapping is released when pool is destroyed.
+bool gtk_icon_cache_map (mem_pool_t *pool, char *theme_dir, struct gtk_icon_cache_t *cache)
+{
+    bool success = false;
+    *cache = ZERO_INIT (struct gtk_icon_cache_t);
+
+    struct path_builder_t path;
+    if (!path_builder_set (&path, theme_dir) || !path_builder_push (&path, "")) {
+        return false;
+    }
+    uint32_t theme_dir_len = path.len;
+    path_builder_push (&path, "icon-theme.cache");
+
+    // If the cache can't be used, ending the temporary memory unmaps it.
+    mem_pool_marker_t mrkr = mem_pool_begin_temporary_memory (pool);
+
+    struct stat cache_st;
+    int fd = open (path.str, O_RDONLY);
+    if (fd != -1 && fstat (fd, &cache_st) == 0 && cache_st.st_size >= 12 && cache_st.st_size < UINT32_MAX) {
+        void *data = mmap (NULL, cache_st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            struct gtk_icon_cache_unmap_clsr_t *info =
+                mem_pool_push_size_cb (pool, sizeof(struct gtk_icon_cache_unmap_clsr_t), gtk_icon_cache_unmap);
+            info->data = data;
+            info->size = cache_st.st_size;
+
+            cache->data = data;
+            cache->size = cache_st.st_size;
+            success = true;
+        }
+    }
+
+    if (fd != -1) {
+        close (fd);
+    }
+
+    uint16_t major, minor;
+    if (success) {
+        success = gtk_icon_cache_u16 (cache, 0, &major) && major == 1 &&
+                  gtk_icon_cache_u16 (cache, 2, &minor) && minor == 0 &&
+                  gtk_icon_cache_u32 (cache, 4, &cache->hash_offset) &&
+                  gtk_icon_cache_u32 (cache, 8, &cache->dir_list_offset) &&
+                  gtk_icon_cache_u32 (cache, cache->hash_offset, &cache->num_buckets) &&
+                  gtk_icon_cache_u32 (cache, cache->dir_list_offset, &cache->num_dirs) &&
+                  cache->hash_offset + 4 + 4*(uint64_t)cache->num_buckets <= cache->size &&
+                  cache->dir_list_offset + 4 + 4*(uint64_t)cache->num_dirs <= cache->size;
+    }
+
+    // Check the cache is newer than the theme directory, and all directories
+    // in it. Adding or removing a file only changes the modification time of
+    // the directory that contains it.
+    if (success) {
+        path_builder_truncate (&path, theme_dir_len);
+        success = !gtk_icon_cache_is_stale (&cache_st, path.str);
+
+        for (uint32_t i=0; success && i<cache->num_dirs; i++) {
+            char *dir_name = gtk_icon_cache_dir_name (cache, i);
+            if (dir_name == NULL) {
+                success = false;
+            } else {
+                path_builder_truncate (&path, theme_dir_len);
+                success = path_builder_push (&path, dir_name) &&
+                          !gtk_icon_cache_is_stale (&cache_st, path.str);
+            }
+        }
+    }
+
+    if (!success) {
+        mem_pool_end_temporary_memory (mrkr);
+        *cache = ZERO_INIT (struct gtk_icon_cache_t);
+    }
+
+    return success;
+}
+
+// Iterator over all images in the cache. The following code prints the name,
+// directory and flags for all images in a cache:
+//
+//    struct gtk_icon_cache_iter_t it = gtk_icon_cache_iter (&cache);
+//    char *name;
+//    uint16_t dir_idx, flags;
+//    while (gtk_icon_cache_next_image (&it, &name, &dir_idx, &flags)) {
+//        printf ("%s/%s (%x)\n", gtk_icon_cache_dir_name (&cache, dir_idx), name, flags);
+//    }
+struct gtk_icon_cache_iter_t {
+    struct gtk_icon_cache_t *cache;
+
+    uint32_t bucket;
+    uint32_t icon_offset;
+    char *name;
+    uint32_t image_list_offset;
+    uint32_t num_images;
+    uint32_t image_idx;
+
+    // Bound the work done on a corrupt cache, chains could be cyclic. A valid
+    // cache can't have more icons or images than fit in the file.
+    uint32_t icons_left;
+    uint32_t images_left;
+};
+
+struct gtk_icon_cache_iter_t gtk_icon_cache_iter (struct gtk_icon_cache_t *cache)
+{
+    struct gtk_icon_cache_iter_t it = ZERO_INIT (struct gtk_icon_cache_iter_t);
+    it.cache = cache;
+    it.icon_offset = GTK_ICON_CACHE_END;
+    it.icons_left = cache->size/12;
+    it.images_left = cache->size/8;
+    return it;
+}
+
+// NOTE: Returns false at the end of the cache, if an offset points outside of
+// the file, or if there are more icons or images than could fit in it. A
+// truncated or corrupt cache will at worst give us a partial list of names.
+bool gtk_icon_cache_next_image (struct gtk_icon_cache_iter_t *it,
+                                char **name, uint16_t *dir_idx, uint16_t *flags)
+{
+    struct gtk_icon_cache_t *cache = it->cache;
+
+    // Advance to the next icon that has images left, following the chain of
+    // the current bucket, then the following buckets.
+    while (it->image_idx >= it->num_images) {
+        uint32_t name_offset;
+        if (it->icon_offset != GTK_ICON_CACHE_END) {
+            if (!gtk_icon_cache_u32 (cache, it->icon_offset, &it->icon_offset)) return false;
+
+        } else {
+            if (it->bucket >= cache->num_buckets) return false;
+            if (!gtk_icon_cache_u32 (cache, cache->hash_offset + 4 + 4*it->bucket, &it->icon_offset)) return false;
+            it->bucket++;
+        }
+
+        if (it->icon_offset == GTK_ICON_CACHE_END) continue;
+
+        if (it->icons_left == 0 || it->icon_offset > cache->size - 12) return false;
+        it->icons_left--;
+
+        if (!gtk_icon_cache_u32 (cache, it->icon_offset + 4, &name_offset) ||
+            !gtk_icon_cache_u32 (cache, it->icon_offset + 8, &it->image_list_offset) ||
+            !gtk_icon_cache_u32 (cache, it->image_list_offset, &it->num_images) ||
+            it->image_list_offset + 4 + 8*(uint64_t)it->num_images > cache->size ||
+            (it->name = gtk_icon_cache_str (cache, name_offset)) == NULL) {
+            return false;
+        }
+        it->image_idx = 0;
+    }
+
+    if (it->images_left == 0) return false;
+    it->images_left--;
+
+    uint32_t image_offset = it->image_list_offset + 4 + 8*it->image_idx;
+    if (!gtk_icon_cache_u16 (cache, image_offset, dir_idx) ||
+        !gtk_icon_cache_u16 (cache, image_offset + 2, flags)) {
+        return false;
+    }
+
+    *name = it->name;
+    it->image_idx++;
+    return true;
+}
@@ -2,19 +2,140 @@
  * Copyright (C) 2018 Santiago León O.
  */
 
-#define UNSELECTED_ICON_BOX_STYLE       \
-"box {"                                 \
-"    padding: 6px;"                     \
-"    border-radius: 3px;"               \
-"    border: 1px solid rgba(0,0,0,0);"  \
-"}"
-
-#define SELECTED_ICON_BOX_STYLE \
-"box {"                         \
-"    padding: 6px;"             \
-"    border-radius: 3px;"       \
-"    border: 1px solid #777;"   \
-"}"
+// Removes all images from the store but keeps its arrays, so pushing the same
+// number of images again doesn't allocate.
+void icon_image_store_clear (struct icon_image_store_t *store)
+{
+    for (uint32_t i=0; i<store->num_images; i++) {
+        if (store->ui[i].surface != NULL) {
+            cairo_surface_destroy (store->ui[i].surface);
+        }
+    }
+
+    store->num_images = 0;
+    store->strings.used = 0;
+}
+
+void icon_image_store_destroy (struct icon_image_store_t *store)
+{
+    icon_image_store_clear (store);
+
+    free (store->size);
+    free (store->width);
+    free (store->height);
+    free (store->scale);
+    free (store->is_scalable);
+    free (store->min_size);
+    free (store->max_size);
+    free (store->full_path);
+    free (store->dir_len);
+    free (store->type);
+    free (store->context);
+    free (store->file_size);
+    free (store->cache_key);
+    free (store->next);
+    free (store->ui);
+    cont_buff_destroy (&store->strings);
+    *store = ZERO_INIT (struct icon_image_store_t);
+}
+
+ON_DESTROY_CALLBACK (icon_image_store_pool_destroy)
+{
+    icon_image_store_destroy ((struct icon_image_store_t*)allocated);
+}
+
+// Creates a store that is destroyed together with pool.
+struct icon_image_store_t* icon_image_store_new (mem_pool_t *pool)
+{
+    struct icon_image_store_t *store =
+        mem_pool_push_size_cb (pool, sizeof(struct icon_image_store_t), icon_image_store_pool_destroy);
+    *store = ZERO_INIT (struct icon_image_store_t);
+    return store;
+}
+
+#define icon_image_store_resize(array,n) array = realloc (array, (n)*sizeof(*(array)))
+
+// Adds an image with the file at full_path, where the first dir_len bytes are
+// the theme directory. All other metadata is set to 0 or NULL.
+uint32_t icon_image_store_push (struct icon_image_store_t *store, const char *full_path, uint32_t dir_len)
+{
+    if (store->num_images == store->capacity) {
+        uint32_t capacity = MAX (16, 2*store->capacity);
+        icon_image_store_resize (store->size, capacity);
+        icon_image_store_resize (store->width, capacity);
+        icon_image_store_resize (store->height, capacity);
+        icon_image_store_resize (store->scale, capacity);
+        icon_image_store_resize (store->is_scalable, capacity);
+        icon_image_store_resize (store->min_size, capacity);
+        icon_image_store_resize (store->max_size, capacity);
+        icon_image_store_resize (store->full_path, capacity);
+        icon_image_store_resize (store->dir_len, capacity);
+        icon_image_store_resize (store->type, capacity);
+        icon_image_store_resize (store->context, capacity);
+        icon_image_store_resize (store->file_size, capacity);
+        icon_image_store_resize (store->cache_key, capacity);
+        icon_image_store_resize (store->next, capacity);
+        icon_image_store_resize (store->ui, capacity);
+        store->capacity = capacity;
+    }
+
+    uint32_t id = store->num_images++;
+    store->size[id] = 0;
+    store->width[id] = 0;
+    store->height[id] = 0;
+    store->scale[id] = 1;
+    store->is_scalable[id] = false;
+    store->min_size[id] = 0;
+    store->max_size[id] = 0;
+    store->type[id] = NULL;
+    store->context[id] = NULL;
+    store->file_size[id] = 0;
+    store->cache_key[id] = ZERO_INIT (struct image_cache_key_t);
+    store->next[id] = ICON_IMAGE_NONE;
+
+    uint32_t len = strlen (full_path);
+    store->full_path[id] = store->strings.used;
+    memcpy (cont_buff_push (&store->strings, len+1), full_path, len+1);
+    store->dir_len[id] = MIN (dir_len, len);
+
+    store->ui[id] = ZERO_INIT (struct icon_image_ui_t);
+    return id;
+}
+
+// Converts a size from the index file into the one kept in the store. Index
+// files use -1 for sizes that weren't specified, the store uses 0.
+static inline
+uint16_t icon_image_size_from_index (int size)
+{
+    return size < 1 ? 0 : MIN (size, UINT16_MAX);
+}
+
+static inline
+char* icon_image_full_path (struct icon_image_store_t *store, uint32_t id)
+{
+    return (char*)store->strings.data + store->full_path[id];
+}
+
+// Path of the image relative to the theme directory.
+static inline
+char* icon_image_path (struct icon_image_store_t *store, uint32_t id)
+{
+    return icon_image_full_path (store, id) + store->dir_len[id];
+}
+
+// Returns the label shown under the image, or NULL if it has none. For the
+// theme that contains unthemed icons sizes are unknown so there is no label.
+char* icon_image_label (struct icon_image_store_t *store, uint32_t id, char *buff, size_t buff_len)
+{
+    if (store->is_scalable[id]) {
+        return "Scalable";
+    } else if (store->size[id] > 0) {
+        snprintf (buff, buff_len, "%d", store->size[id]);
+        return buff;
+    } else {
+        return NULL;
+    }
+}
 
 GtkWidget *spaced_grid_new (int spacing)
 {
@@ -98,76 +219,57 @@ void bytes_to_human_readable (off_t size, char *buff, size_t buff_len)
     }
 }
 
-GtkWidget* image_data_dpy_new (struct icon_image_t *img)
+// If id is ICON_IMAGE_NONE all values are shown as missing.
+GtkWidget* image_data_dpy_new (struct icon_image_store_t *store, uint32_t id)
 {
     GtkWidget *data = gtk_grid_new ();
     gtk_grid_set_column_spacing (GTK_GRID(data), 12);
 
-    struct icon_image_t l_img = ZERO_INIT(struct icon_image_t);
-    if (img == NULL) {
-        img = &l_img;
+    mem_pool_t pool = {0};
+    char *theme_dir = NULL, *path = NULL;
+    const char *type = NULL, *context = NULL;
+    int width = 0, height = 0, size = 0, min_size = 0, max_size = 0;
+    off_t file_size = 0;
+    if (id != ICON_IMAGE_NONE) {
+        theme_dir = pom_strndup (&pool, icon_image_full_path (store, id), store->dir_len[id]);
+        path = icon_image_path (store, id);
+        type = store->type[id];
+        context = store->context[id];
+        width = store->width[id];
+        height = store->height[id];
+        size = store->size[id];
+        min_size = store->min_size[id];
+        max_size = store->max_size[id];
+        file_size = store->file_size[id];
     }
 
     int i = 0;
     char *str;
     char buff[10];
 
-    data_dpy_append (data, "Theme Path:", str_or_dash(img->theme_dir), i++);
-    data_dpy_append (data, "File Path:", str_or_dash(img->path), i++);
+    data_dpy_append (data, "Theme Path:", str_or_dash(theme_dir), i++);
+    data_dpy_append (data, "File Path:", str_or_dash(path), i++);
 
-    snprintf (buff, ARRAY_SIZE(buff), "%d x %d", img->width, img->height);
-    str = img->width < 1 || img->height < 1 ?  "-" : buff;
+    snprintf (buff, ARRAY_SIZE(buff), "%d x %d", width, height);
+    str = width < 1 || height < 1 ?  "-" : buff;
     data_dpy_append (data, "Image Size:", str, i++);
 
-    bytes_to_human_readable (img->file_size, buff, ARRAY_SIZE(buff));
+    bytes_to_human_readable (file_size, buff, ARRAY_SIZE(buff));
     data_dpy_append (data, "File Size:", buff, i++);
 
-    snprintf (buff, ARRAY_SIZE(buff), "%d", img->size);
-    str = img->size < 1 ?  "-" : buff;
+    snprintf (buff, ARRAY_SIZE(buff), "%d", size);
+    str = size < 1 ?  "-" : buff;
     data_dpy_append (data, "Size:", str, i++);
 
-    data_dpy_append (data, "Context:", str_or_dash(img->context), i++);
-    data_dpy_append (data, "Type:", str_or_dash(img->type), i++);
+    data_dpy_append (data, "Context:", str_or_dash((char*)context), i++);
+    data_dpy_append (data, "Type:", str_or_dash((char*)type), i++);
 
-    snprintf (buff, ARRAY_SIZE(buff), "%d - %d", img->min_size, img->max_size);
-    str = img->min_size < 1 || img->max_size < 1 ? "-" : buff;
+    snprintf (buff, ARRAY_SIZE(buff), "%d - %d", min_size, max_size);
+    str = min_size < 1 || max_size < 1 ? "-" : buff;
     data_dpy_append (data, "Size Range:", str, i++);
-    return data;
-}
-
-void set_icon_box_border (struct icon_image_t *img)
-{
-    img->custom_css = replace_custom_css (img->box, img->custom_css, SELECTED_ICON_BOX_STYLE);
-}
-
-void unset_icon_box_border (struct icon_image_t *img)
-{
-    img->custom_css = replace_custom_css (img->box, img->custom_css, UNSELECTED_ICON_BOX_STYLE);
-}
-
-gboolean on_image_clicked (GtkWidget *widget, GdkEvent *event, gpointer user_data)
-{
-    struct icon_image_t *img = (struct icon_image_t *)user_data;
-    if (img->view->selected_img != img) {
-        GtkWidget *image_data_dpy = image_data_dpy_new (img);
-        g_assert (img->view->image_data_dpy != NULL);
 
-        unset_icon_box_border (img->view->selected_img);
-
-        img->view->selected_img = img;
-        set_icon_box_border (img);
-
-        // Replace image_data_dpy widget
-        GtkWidget *parent = gtk_widget_get_parent (img->view->image_data_dpy);
-        gtk_container_remove (GTK_CONTAINER(parent), img->view->image_data_dpy);
-        gtk_container_add (GTK_CONTAINER(parent), image_data_dpy);
-        img->view->image_data_dpy = image_data_dpy;
-        gtk_widget_show_all (image_data_dpy);
-    }
-
-    // NOTE: We allways let the event go through so we have drag and drop even
-    // if the image wasn't selected.
-    return FALSE;
+    mem_pool_destroy (&pool);
+    return data;
 }
 
 char* new_bgcolor_style_str (mem_pool_t *pool, char *node_name, dvec4 color)
@@ -202,87 +304,326 @@ void on_color_button_clicked (GtkColorButton *button, gpointer user_data)
     app.bg_color = color;
 }
 
-void on_drag_data_get (GtkWidget *widget, GdkDragContext *context, GtkSelectionData *data,
-                       guint info, guint time, gpointer user_data)
-{
-    struct icon_image_t *img = (struct icon_image_t *)user_data;
-    string_t uri = str_new ("file://");
-    str_cat_c (&uri, img->full_path);
+// The icon strip paints the images of one scale side by side, each one with
+// its label below and a border around the selected one. It used to be a
+// GtkEventBox, GtkBox, GtkImage and GtkLabel per image, each box with its own
+// GtkCssProvider that was replaced to move the selection border. Creating,
+// styling and destroying all those widgets was most of the time it took to
+// show an icon, and selecting an image restyled its whole box. Like
+// fk_list_box_t, this is a single GtkDrawingArea instead. It paints the
+// surfaces decoded by app.image_decoder directly, and does its own hit
+// testing and drag and drop.
+//
+// Sizes are the ones the CSS used to give: 6px of padding and a 1px border
+// around each image, 12px between images, between an image and its label, and
+// around the strip.
+#define ICON_STRIP_MARGIN 12
+#define ICON_STRIP_SPACING 12
+#define ICON_STRIP_PADDING 7 // padding + border
+#define ICON_STRIP_BORDER_RADIUS 3
 
-    char *uris[] = {str_data(&uri), NULL};
-    gtk_selection_data_set_uris (data, uris);
+static inline
+void icon_strip_set_font (cairo_t *cr)
+{
+    cairo_select_font_face (cr, "Open Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size (cr, 12);
+}
 
-    str_free (&uri);
+// Size the image takes in the strip. Images whose size couldn't be read from
+// their header take their nominal size until they are decoded.
+void icon_strip_image_size (struct icon_image_store_t *store, uint32_t id, double *width, double *height)
+{
+    if (store->width[id] > 0 && store->height[id] > 0) {
+        *width = store->width[id];
+        *height = store->height[id];
+    } else {
+        *width = store->size[id]*store->scale[id];
+        *height = *width;
+    }
 }
 
-GtkWidget* icon_view_create_icon_dpy (struct icon_view_t *icon_view, int scale)
+// Lays out the images of icon_view->scale into icon_view->strip_items and
+// sets the size request of the strip. Has to be called again when an image
+// changes size.
+void icon_strip_layout (struct icon_view_t *icon_view)
 {
+    struct icon_image_store_t *store = icon_view->store;
+    uint32_t *images = icon_view->images[icon_view->scale-1];
+    int num_images = icon_view->images_len[icon_view->scale-1];
+    struct icon_strip_item_t *items = icon_view->strip_items;
+
     // NOTE: At least one package (aptdaemon-data) provides animated icons in a
     // single file by appending the frames side by side.  Here we detect that
     // case and instead display these icons vertically.
-    GtkOrientation all_icons_or = icon_view->images[scale-1]->width/icon_view->images[scale-1]->height > 2 ?
-        GTK_ORIENTATION_VERTICAL : GTK_ORIENTATION_HORIZONTAL;
-    GtkWidget *all_icons = gtk_box_new (all_icons_or, 12);
+    icon_view->strip_is_vertical = num_images > 0 && store->height[images[0]] > 0 &&
+        store->width[images[0]]/store->height[images[0]] > 2;
+
+    // Labels are measured with the font they are drawn with.
+    cairo_surface_t *scratch = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *cr = cairo_create (scratch);
+    icon_strip_set_font (cr);
+    cairo_font_extents_t font_extents;
+    cairo_font_extents (cr, &font_extents);
+
+    double max_width = 0, max_height = 0;
+    for (int i=0; i<num_images; i++) {
+        struct icon_strip_item_t *item = &items[i];
+        item->id = images[i];
+        icon_strip_image_size (store, item->id, &item->image_width, &item->image_height);
+
+        char buff[12];
+        char *label = icon_image_label (store, item->id, buff, ARRAY_SIZE(buff));
+        item->label_width = 0;
+        if (label != NULL) {
+            cairo_text_extents_t extents;
+            cairo_text_extents (cr, label, &extents);
+            item->label_width = extents.x_advance;
+        }
 
-    struct icon_image_t *last_img = NULL;
-    struct icon_image_t *img = icon_view->images[scale-1];
+        item->width = MAX (item->image_width, item->label_width) + 2*ICON_STRIP_PADDING;
+        item->height = item->image_height + 2*ICON_STRIP_PADDING;
+        if (label != NULL) {
+            item->height += ICON_STRIP_SPACING + font_extents.ascent + font_extents.descent;
+        }
+
+        max_width = MAX (max_width, item->width);
+        max_height = MAX (max_height, item->height);
+    }
 
-    while (img != NULL) {
-        GtkWidget *box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 12);
-        img->box = box;
-        img->custom_css = add_custom_css (box, UNSELECTED_ICON_BOX_STYLE);
+    cairo_destroy (cr);
+    cairo_surface_destroy (scratch);
+
+    // Images of a horizontal strip are aligned at the bottom, so images with
+    // and without label line up. Boxes of a vertical strip are all as wide as
+    // the widest one.
+    double pos = ICON_STRIP_MARGIN;
+    for (int i=0; i<num_images; i++) {
+        struct icon_strip_item_t *item = &items[i];
+        if (icon_view->strip_is_vertical) {
+            item->x = ICON_STRIP_MARGIN;
+            item->y = pos;
+            item->width = max_width;
+            pos += item->height + ICON_STRIP_SPACING;
 
-        gtk_widget_set_valign (box,GTK_ALIGN_END);
-        gtk_widget_set_vexpand (box, FALSE);
+        } else {
+            item->x = pos;
+            item->y = ICON_STRIP_MARGIN + max_height - item->height;
+            pos += item->width + ICON_STRIP_SPACING;
+        }
+    }
+    pos += ICON_STRIP_MARGIN - (num_images > 0 ? ICON_STRIP_SPACING : 0);
+
+    if (icon_view->strip_is_vertical) {
+        icon_view->strip_width = max_width + 2*ICON_STRIP_MARGIN;
+        icon_view->strip_height = pos;
+    } else {
+        icon_view->strip_width = pos;
+        icon_view->strip_height = max_height + 2*ICON_STRIP_MARGIN;
+    }
 
-        gtk_container_add (GTK_CONTAINER(box), img->image);
+    if (icon_view->icon_strip != NULL) {
+        gtk_widget_set_size_request (icon_view->icon_strip,
+                                     ceil (icon_view->strip_width), ceil (icon_view->strip_height));
+    }
+}
 
-        if (img->label != NULL) {
-            GtkWidget *label = gtk_label_new (img->label);
-            gtk_widget_set_valign (label, GTK_ALIGN_START);
-            gtk_label_set_justify (GTK_LABEL(label), GTK_JUSTIFY_CENTER);
-            gtk_container_add (GTK_CONTAINER(box), label);
+uint32_t icon_strip_hit_test (struct icon_view_t *icon_view, double x, double y)
+{
+    for (int i=0; i<icon_view->images_len[icon_view->scale-1]; i++) {
+        struct icon_strip_item_t *item = &icon_view->strip_items[i];
+        if (x >= item->x && x < item->x + item->width &&
+            y >= item->y && y < item->y + item->height) {
+            return item->id;
         }
+    }
+    return ICON_IMAGE_NONE;
+}
 
-        GtkWidget *hitbox = gtk_event_box_new ();
-        g_signal_connect (G_OBJECT(hitbox), "button-press-event", G_CALLBACK(on_image_clicked), img);
+void cairo_rounded_rectangle (cairo_t *cr, double x, double y, double width, double height, double radius)
+{
+    cairo_new_sub_path (cr);
+    cairo_arc (cr, x + width - radius, y + radius, radius, -M_PI/2, 0);
+    cairo_arc (cr, x + width - radius, y + height - radius, radius, 0, M_PI/2);
+    cairo_arc (cr, x + radius, y + height - radius, radius, M_PI/2, M_PI);
+    cairo_arc (cr, x + radius, y + radius, radius, M_PI, 3*M_PI/2);
+    cairo_close_path (cr);
+}
 
-        // Setup DnD of images
-        {
-            gtk_drag_source_set (hitbox, GDK_BUTTON1_MASK, NULL, 0, GDK_ACTION_COPY);
-            gtk_drag_source_add_uri_targets (hitbox);
-            GdkPixbuf *pixbuf = gtk_image_get_pixbuf (GTK_IMAGE(img->image));
-            gtk_drag_source_set_icon_pixbuf (hitbox, pixbuf);
-            g_signal_connect (G_OBJECT(hitbox), "drag-data-get", G_CALLBACK(on_drag_data_get), img);
+gboolean icon_strip_draw (GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+    dvec4 text_color = RGB_255(66,66,66);
+    dvec4 border_color = RGB_HEX(0x777777);
+
+    struct icon_view_t *icon_view = (struct icon_view_t*)data;
+    struct icon_image_store_t *store = icon_view->store;
+
+    icon_strip_set_font (cr);
+    cairo_font_extents_t font_extents;
+    cairo_font_extents (cr, &font_extents);
+
+    // Only images inside the area being redrawn are painted, strips of icons
+    // with many images are mostly scrolled out of view.
+    double clip_x1, clip_y1, clip_x2, clip_y2;
+    cairo_clip_extents (cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+
+    for (int i=0; i<icon_view->images_len[icon_view->scale-1]; i++) {
+        struct icon_strip_item_t *item = &icon_view->strip_items[i];
+        if (item->x > clip_x2 || item->x + item->width < clip_x1 ||
+            item->y > clip_y2 || item->y + item->height < clip_y1) {
+            continue;
         }
 
-        gtk_container_add (GTK_CONTAINER(hitbox), box);
+        if (item->id == icon_view->selected_img) {
+            cairo_rounded_rectangle (cr, item->x + 0.5, item->y + 0.5,
+                                     item->width - 1, item->height - 1, ICON_STRIP_BORDER_RADIUS);
+            cairo_set_source_rgb (cr, ARGS_RGB(border_color));
+            cairo_set_line_width (cr, 1);
+            cairo_stroke (cr);
+        }
 
-        gtk_container_add (GTK_CONTAINER(all_icons), hitbox);
+        // Round image positions so they are painted pixel aligned, not
+        // blurred.
+        double image_x = floor (item->x + (item->width - item->image_width)/2);
+        double image_y = item->y + ICON_STRIP_PADDING;
+        cairo_surface_t *surface = store->ui[item->id].surface;
+        if (surface != NULL) {
+            cairo_set_source_surface (cr, surface, image_x, image_y);
+            cairo_rectangle (cr, image_x, image_y, item->image_width, item->image_height);
+            cairo_fill (cr);
+        }
 
-        if(img->next == NULL) {
-            icon_view->selected_img = img;
-            set_icon_box_border (img);
-            last_img = img;
+        char buff[12];
+        char *label = icon_image_label (store, item->id, buff, ARRAY_SIZE(buff));
+        if (label != NULL) {
+            cairo_move_to (cr, item->x + (item->width - item->label_width)/2,
+                           image_y + item->image_height + ICON_STRIP_SPACING + font_extents.ascent);
+            cairo_set_source_rgb (cr, ARGS_RGB(text_color));
+            cairo_show_text (cr, label);
         }
-        img = img->next;
     }
 
-    // Place the icon list inside a GtkGrid so they are centered
-    GtkWidget *icon_dpy = spaced_grid_new (12);
-    gtk_widget_set_valign (icon_dpy, GTK_ALIGN_CENTER);
-    gtk_widget_set_halign (icon_dpy, GTK_ALIGN_CENTER);
-    gtk_widget_set_hexpand (icon_dpy, TRUE);
-    gtk_widget_set_vexpand (icon_dpy, TRUE);
-    gtk_grid_attach (GTK_GRID(icon_dpy), all_icons, 0, 0, 1, 1);
+    return TRUE;
+}
 
-    if (icon_view->image_data_dpy == NULL) {
-        icon_view->image_data_dpy = image_data_dpy_new (last_img);
-    } else {
-        replace_wrapped_widget (&icon_view->image_data_dpy, image_data_dpy_new (last_img));
+void icon_view_select_image (struct icon_view_t *icon_view, uint32_t id)
+{
+    if (icon_view->selected_img == id) return;
+
+    icon_view->selected_img = id;
+    replace_wrapped_widget (&icon_view->image_data_dpy, image_data_dpy_new (icon_view->store, id));
+    gtk_widget_queue_draw (icon_view->icon_strip);
+}
+
+gboolean icon_strip_button_press (GtkWidget *widget, GdkEventButton *e, gpointer data)
+{
+    struct icon_view_t *icon_view = (struct icon_view_t*)data;
+    if (e->type != GDK_BUTTON_PRESS) {
+        return FALSE;
+    }
+
+    uint32_t id = icon_strip_hit_test (icon_view, e->x, e->y);
+    if (id != ICON_IMAGE_NONE) {
+        icon_view_select_image (icon_view, id);
+    }
+
+    // Any image that is clicked can be dragged, even if it wasn't selected
+    // before.
+    icon_view->drag_img = e->button == GDK_BUTTON_PRIMARY ? id : ICON_IMAGE_NONE;
+    icon_view->press_x = e->x;
+    icon_view->press_y = e->y;
+    return id != ICON_IMAGE_NONE;
+}
+
+gboolean icon_strip_motion_notify (GtkWidget *widget, GdkEventMotion *e, gpointer data)
+{
+    struct icon_view_t *icon_view = (struct icon_view_t*)data;
+    if (icon_view->drag_img == ICON_IMAGE_NONE || !(e->state & GDK_BUTTON1_MASK) ||
+        !gtk_drag_check_threshold (widget, icon_view->press_x, icon_view->press_y, e->x, e->y)) {
+        return FALSE;
+    }
+
+    GtkTargetList *targets = gtk_target_list_new (NULL, 0);
+    gtk_target_list_add_uri_targets (targets, 0);
+    gtk_drag_begin_with_coordinates (widget, targets, GDK_ACTION_COPY, GDK_BUTTON_PRIMARY,
+                                     (GdkEvent*)e, icon_view->press_x, icon_view->press_y);
+    gtk_target_list_unref (targets);
+    return TRUE;
+}
+
+void icon_strip_drag_begin (GtkWidget *widget, GdkDragContext *context, gpointer data)
+{
+    struct icon_view_t *icon_view = (struct icon_view_t*)data;
+    // The icon of images still being decoded is the default one.
+    cairo_surface_t *surface = icon_view->store->ui[icon_view->drag_img].surface;
+    if (surface != NULL) {
+        gtk_drag_set_icon_surface (context, surface);
+    }
+}
+
+void icon_strip_drag_data_get (GtkWidget *widget, GdkDragContext *context, GtkSelectionData *data,
+                               guint info, guint time, gpointer user_data)
+{
+    struct icon_view_t *icon_view = (struct icon_view_t*)user_data;
+    string_t uri = str_new ("file://");
+    str_cat_c (&uri, icon_image_full_path (icon_view->store, icon_view->drag_img));
+
+    char *uris[] = {str_data(&uri), NULL};
+    gtk_selection_data_set_uris (data, uris);
+
+    str_free (&uri);
+}
+
+void icon_strip_destroy_cb (GtkWidget *widget, gpointer data)
+{
+    struct icon_view_t *icon_view = (struct icon_view_t*)data;
+    if (icon_view->icon_strip == widget) {
+        icon_view->icon_strip = NULL;
     }
+}
 
-    // Wrap icon_dpy into a GtkScrolledWindow
+GtkWidget* icon_strip_new (struct icon_view_t *icon_view)
+{
+    GtkWidget *strip = gtk_drawing_area_new ();
+    icon_view->icon_strip = strip;
+    icon_view->drag_img = ICON_IMAGE_NONE;
+
+    // The strip is as large as its size request, centered in the scrolled
+    // window.
+    gtk_widget_set_valign (strip, GTK_ALIGN_CENTER);
+    gtk_widget_set_halign (strip, GTK_ALIGN_CENTER);
+    gtk_widget_set_hexpand (strip, TRUE);
+    gtk_widget_set_vexpand (strip, TRUE);
+
+    gtk_widget_add_events (strip,
+                           GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK |
+                           GDK_BUTTON1_MOTION_MASK);
+
+    g_signal_connect (G_OBJECT(strip), "draw", G_CALLBACK(icon_strip_draw), icon_view);
+    g_signal_connect (G_OBJECT(strip), "button-press-event", G_CALLBACK(icon_strip_button_press), icon_view);
+    g_signal_connect (G_OBJECT(strip), "motion-notify-event", G_CALLBACK(icon_strip_motion_notify), icon_view);
+    g_signal_connect_after (G_OBJECT(strip), "drag-begin", G_CALLBACK(icon_strip_drag_begin), icon_view);
+    g_signal_connect (G_OBJECT(strip), "drag-data-get", G_CALLBACK(icon_strip_drag_data_get), icon_view);
+    g_signal_connect (G_OBJECT(strip), "destroy", G_CALLBACK(icon_strip_destroy_cb), icon_view);
+
+    icon_strip_layout (icon_view);
+    return strip;
+}
+
+// Shows the images of scale in the icon strip, and selects the largest one.
+void icon_view_set_scale (struct icon_view_t *icon_view, int scale)
+{
+    icon_view->scale = scale;
+
+    int num_images = icon_view->images_len[scale-1];
+    icon_view->selected_img = num_images > 0 ? icon_view->images[scale-1][num_images-1] : ICON_IMAGE_NONE;
+    icon_view->drag_img = ICON_IMAGE_NONE;
+}
+
+GtkWidget* icon_view_create_icon_dpy (struct icon_view_t *icon_view)
+{
+    GtkWidget *icon_strip = icon_strip_new (icon_view);
+
+    // Wrap icon_strip into a GtkScrolledWindow
     GtkWidget *scrolled_window = gtk_scrolled_window_new (NULL, NULL);
     mem_pool_t pool = {0};
     icon_view->scrolled_window_custom_css =
@@ -292,7 +633,7 @@ GtkWidget* icon_view_create_icon_dpy (struct icon_view_t *icon_view, int scale)
 
     gtk_widget_set_hexpand (scrolled_window, TRUE);
     gtk_widget_set_vexpand (scrolled_window, TRUE);
-    gtk_container_add (GTK_CONTAINER (scrolled_window), icon_dpy);
+    gtk_container_add (GTK_CONTAINER (scrolled_window), icon_strip);
 
     GdkRGBA c = GDK_RGBA_FROM_RGBA(app.bg_color);
     GtkWidget *button = gtk_color_button_new_with_rgba (&c);
@@ -319,9 +660,12 @@ void on_scale_toggled (GtkToggleButton *button, gpointer user_data)
     struct icon_view_t *icon_view = (struct icon_view_t *) user_data;
 
     if (gtk_toggle_button_get_active(button)) {
-        int scale = gtk_radio_button_get_idx (GTK_RADIO_BUTTON(button));
-        GtkWidget *icon_dpy = icon_view_create_icon_dpy (icon_view, scale);
-        replace_wrapped_widget (&icon_view->icon_dpy, icon_dpy);
+        // Only the layout of the strip changes, the widgets stay.
+        icon_view_set_scale (icon_view, gtk_radio_button_get_idx (GTK_RADIO_BUTTON(button)));
+        icon_strip_layout (icon_view);
+        gtk_widget_queue_draw (icon_view->icon_strip);
+        replace_wrapped_widget (&icon_view->image_data_dpy,
+                                image_data_dpy_new (icon_view->store, icon_view->selected_img));
     }
 }
 
@@ -338,7 +682,7 @@ GtkWidget* scale_selector_new (struct icon_view_t *icon_view)
         GtkWidget *scale_button = gtk_radio_button_new_with_label (group, buff);
         gtk_toggle_button_set_mode (GTK_TOGGLE_BUTTON(scale_button), FALSE);
         gtk_container_add (GTK_CONTAINER(selector), scale_button);
-        if (icon_view->images[i] != NULL) {
+        if (icon_view->images_len[i] > 0) {
             g_signal_connect (G_OBJECT(scale_button), "toggled", G_CALLBACK(on_scale_toggled), icon_view);
         } else {
             gtk_widget_set_sensitive (scale_button, FALSE);
@@ -361,9 +705,79 @@ void on_icon_view_theme_changed (GtkComboBox *themes_combobox, gpointer user_dat
     }
 }
 
+// Called from the main loop when the image id of store was decoded by
+// app.image_decoder, or found in app.image_cache. Only called while the icon
+// view the image belongs to is shown.
+void icon_view_image_decoded (struct icon_image_store_t *store, uint32_t id, cairo_surface_t *surface)
+{
+    struct icon_image_ui_t *img = &store->ui[id];
+    struct icon_view_t *view = img->view;
+    if (view == NULL) return;
+
+    if (img->surface != NULL) {
+        cairo_surface_destroy (img->surface);
+    }
+    img->surface = cairo_surface_reference (surface);
+
+    uint16_t width = MIN (cairo_image_surface_get_width (surface), UINT16_MAX);
+    uint16_t height = MIN (cairo_image_surface_get_height (surface), UINT16_MAX);
+    bool resized = width != store->width[id] || height != store->height[id];
+    store->width[id] = width;
+    store->height[id] = height;
+
+    if (view->icon_strip != NULL) {
+        if (resized) {
+            icon_strip_layout (view);
+        }
+        gtk_widget_queue_draw (view->icon_strip);
+    }
+
+    // The image size shown for the selected image is now known.
+    if (view->selected_img == id &&
+        view->image_data_dpy != NULL && gtk_widget_get_parent (view->image_data_dpy) != NULL) {
+        replace_wrapped_widget (&view->image_data_dpy, image_data_dpy_new (store, id));
+    }
+}
+
+// Sets the images of icon_view that are in app.image_cache, and requests
+// decoding the rest. Results of requests made for previously shown icon views
+// are dropped.
+void icon_view_request_images (struct icon_view_t *icon_view)
+{
+    struct image_decoder_t *decoder = &app.image_decoder;
+    image_decoder_next_generation (decoder);
+
+    struct icon_image_store_t *store = icon_view->store;
+    for (int i=0; i<ARRAY_SIZE(icon_view->images); i++) {
+        for (int j=0; j<icon_view->images_len[i]; j++) {
+            uint32_t id = icon_view->images[i][j];
+            if (store->ui[id].surface != NULL) {
+                continue;
+            }
+
+            cairo_surface_t *surface = image_cache_lookup (&app.image_cache, &store->cache_key[id]);
+            if (surface != NULL) {
+                icon_view_image_decoded (store, id, surface);
+            } else {
+                image_decoder_request (decoder, store, id, icon_image_full_path (store, id),
+                                       &store->cache_key[id]);
+            }
+        }
+    }
+}
+
 GtkWidget* draw_icon_view (struct icon_view_t *icon_view)
 {
-    icon_view->icon_dpy = icon_view_create_icon_dpy (icon_view, 1);
+    // The scale selector starts at 1X.
+    icon_view->image_data_dpy = NULL;
+    icon_view_set_scale (icon_view, 1);
+    icon_view->icon_dpy = icon_view_create_icon_dpy (icon_view);
+
+    // Images found in the cache are set right away, so the strip must exist
+    // to be laid out again. The data of the selected image is shown after
+    // that, so it has their real size.
+    icon_view_request_images (icon_view);
+    icon_view->image_data_dpy = image_data_dpy_new (icon_view->store, icon_view->selected_img);
 
     // Create the icon data pane
     GtkWidget *data_pane = spaced_grid_new (12);
@@ -379,10 +793,12 @@ GtkWidget* draw_icon_view (struct icon_view_t *icon_view)
     if (app.selected_theme_type == THEME_TYPE_ALL || app.selected_theme_type == THEME_TYPE_NORMAL) {
         GtkWidget *themes_combobox;
         theme_selector = labeled_combobox_new ("Theme:", &themes_combobox);
-        for (struct icon_theme_t *curr_theme = app.themes; curr_theme; curr_theme = curr_theme->next) {
-            if (g_hash_table_contains (curr_theme->icon_names, icon_view->icon_name)) {
-                combo_box_text_append_text_with_id (GTK_COMBO_BOX_TEXT(themes_combobox), curr_theme->name);
-            }
+        struct icon_name_themes_iter_t it =
+            icon_name_themes_iter (&app.icon_name_themes, atom_of_str (icon_view->icon_name));
+        uint32_t order;
+        while (icon_name_themes_next (&it, &order)) {
+            struct icon_theme_t *curr_theme = app.loader.themes[order];
+            combo_box_text_append_text_with_id (GTK_COMBO_BOX_TEXT(themes_combobox), curr_theme->name);
         }
 
         gtk_combo_box_set_active_id (GTK_COMBO_BOX(themes_combobox), app.selected_theme->name);
@@ -2,45 +2,107 @@
  * Copyright (C) 2018 Santiago León O.
  */
 
-struct icon_image_t {
-    GtkWidget *image;
-    int width, height;
-    char *label; // can be NULL
-
-    // Information found in the index file
-    char *theme_dir;
-    char *path;
-    char *full_path;
-    off_t file_size;
-    int size;
-    int min_size;
-    int max_size;
-    int scale;
-    char* type; // can be NULL
-    char* context; // can be NULL
-    bool is_scalable; // True if directory in index file contains "scalable"
-
-    struct icon_image_t *next;
-    struct icon_view_t *view; // Pointer to the icon_view_t this icon_image_t is member of.
+// Metadata of icon images is stored as parallel arrays indexed by an image id,
+// so sorting and laying out images only touches the few small fields that
+// are needed. Paths are offsets into a single string buffer, the theme
+// directory is a prefix of the full path so it's stored as a length. Decoded
+// images are kept in a separate side table, in the same order.
+//
+// All images of the folder theme live in a single store allocated in the
+// folder theme pool, it's destroyed together with the pool. The icon view of
+// other themes reuses app.icon_view_store, which is cleared each time a new
+// icon is selected. Clearing or destroying a store releases the surfaces it
+// holds.
+//
+// WARNING: Pushing images may move all arrays. Don't keep pointers into a
+// store until all images were pushed.
 
-    // UI Widgets
-    GtkWidget *box;
-    GtkCssProvider *custom_css;
+#define ICON_IMAGE_NONE UINT32_MAX
+
+struct icon_image_ui_t {
+    struct icon_view_t *view; // The icon_view_t this image is member of.
+
+    // Decoded image, NULL until app.image_decoder is done with it. Usually
+    // shared with app.image_cache.
+    cairo_surface_t *surface;
+};
+
+struct icon_image_store_t {
+    uint32_t num_images;
+    uint32_t capacity;
+
+    // Sizes are 0 where unknown, see icon_image_size_from_index().
+
+    // Used to sort and lay out images.
+    uint16_t *size;
+    uint16_t *width;
+    uint16_t *height;
+    uint8_t *scale;
+    bool *is_scalable; // True if directory in index file contains "scalable"
+
+    // Only used to show the information of the selected image.
+    uint16_t *min_size;
+    uint16_t *max_size;
+    uint32_t *full_path; // offset into strings
+    uint16_t *dir_len; // length of the theme directory at the start of full_path, can be 0
+    const char **type; // can be NULL, owned by the theme
+    const char **context; // can be NULL, owned by the theme
+    off_t *file_size;
+
+    // Identifies the decoded image in app.image_cache. Zeroed if the file
+    // couldn't be stat()ed.
+    struct image_cache_key_t *cache_key;
+
+    // Chains images of the same icon view and scale while they are pushed.
+    uint32_t *next;
+
+    cont_buff_t strings;
+    struct icon_image_ui_t *ui;
+};
+
+// Layout of an image in the icon strip. The box is what the selection border
+// surrounds, the image is centered in it with the label below.
+struct icon_strip_item_t {
+    uint32_t id;
+    double x, y, width, height; // box
+    double image_width, image_height;
+    double label_width; // 0 if the image has no label
 };
 
 #define IV_MAX_SCALE 3
 struct icon_view_t {
     char *icon_name;
 
-    int scale;
-    struct icon_image_t *images[IV_MAX_SCALE];
-    struct icon_image_t *images_end[IV_MAX_SCALE];
+    struct icon_image_store_t *store;
+
+    int scale; // of the images shown in the icon strip
+    // Ids of the images of each scale, sorted by size. Filled by
+    // icon_view_compute_derived_data(), before that images are chained from
+    // images_first through store->next.
+    uint32_t *images[IV_MAX_SCALE];
     int images_len[IV_MAX_SCALE];
+    uint32_t images_first[IV_MAX_SCALE];
+    uint32_t images_last[IV_MAX_SCALE];
 
     // UI Widgets
     GtkWidget *icon_dpy;
     GtkWidget *image_data_dpy;
-    struct icon_image_t *selected_img;
+    uint32_t selected_img;
+
+    // The icon strip is a single GtkDrawingArea that paints the images of one
+    // scale, see icon_strip_new(). Its layout is kept here so clicks can be
+    // hit tested against it.
+    GtkWidget *icon_strip;
+    struct icon_strip_item_t *strip_items; // one per image of the largest scale
+    bool strip_is_vertical;
+    double strip_width;
+    double strip_height;
+
+    // Image under the pointer when button 1 was pressed, it's dragged if the
+    // pointer moves far enough.
+    uint32_t drag_img;
+    double press_x;
+    double press_y;
 
     GtkWidget *scrolled_window;
     GtkCssProvider *scrolled_window_custom_css;
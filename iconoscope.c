@@ -15,7 +15,13 @@ void app_set_selected_theme (struct app_t *app, const char *theme_name);
 void app_set_icon_view (struct app_t *app, const char *icon_name);
 void app_set_normal_theme (struct app_t *app, const char *theme_name, const char *selected_icon);
 
+#include "image_probe.c"
+#include "image_cache.c"
 #include "icon_view.h"
+#include "image_decoder.c"
+#include "icon_cache.c"
+#include "atom_table.c"
+#include "atom_map.c"
 
 // TODO: Support svgz extension (at least Kdenlive uses it). Because GtkImage
 // doesn't understand them (yet), we may need to call gzip.
@@ -33,6 +39,33 @@ enum valid_extensions {
     NUM_EXTENSIONS
 };
 
+// A directory section of an index.theme file. Values that are not present in
+// the file are -1, except scale which defaults to 1.
+struct theme_section_t {
+    char *name; // Without trailing '/'
+    uint32_t name_len;
+
+    int size;
+    int min_size;
+    int max_size;
+    int scale;
+    char *type; // can be NULL
+    char *context; // can be NULL
+    bool is_scalable;
+};
+
+// Where an image for an icon was found while scanning a theme. dir is the
+// index into the theme's dirs, section the index into its sections and ext the
+// index into valid_extensions. If there are images with different extensions
+// in the same directory, only the one with higher priority is kept.
+#define ICON_LOCATION_NO_SECTION 0xFFFF
+struct icon_location_t {
+    struct icon_location_t *next;
+    uint16_t dir;
+    uint16_t section;
+    uint8_t ext;
+};
+
 struct icon_theme_t {
     mem_pool_t pool;
 
@@ -40,9 +73,43 @@ struct icon_theme_t {
     uint32_t num_dirs;
     char **dirs;
     char *index_file;
+    char *index_file_path;
     char *dir_name;
 
-    GHashTable *icon_names;
+    // Parsed from index_file by icon_theme_parse_index_file().
+    uint32_t num_sections;
+    struct theme_section_t *sections;
+
+    // Maps icon names to a linked list of struct icon_location_t. Keys are
+    // strings, it's only used while scanning and destroyed by
+    // icon_theme_intern_icon_names().
+    GHashTable *scan_icon_names;
+
+    // Maps atoms from app.atoms to a linked list of struct icon_location_t,
+    // built from scan_icon_names once the theme is loaded. Allocated in pool.
+    struct atom_map_t icon_names;
+
+    // Atoms of all keys in icon_names, sorted by atom_sort(). Computed once
+    // when the theme is loaded, the icon list of the theme is built in this
+    // order, and the All theme list is built by merging them.
+    uint32_t num_icon_names;
+    atom_t *sorted_icon_names;
+
+    // Names copied and icon-theme.cache files mapped while scanning. It's the
+    // pool of the thread that scans the theme, it's reset once names are
+    // interned so the next theme scanned by that thread reuses its memory.
+    mem_pool_t *scan_pool;
+
+    // Modification times of everything scanned to get icon_names, and the
+    // theme with the same directories in the startup index, if any.
+    uint32_t num_stamps;
+    struct file_stamp_t *stamps;
+    struct startup_index_theme_t *index_record;
+    bool scanned;
+
+    // Position of the theme in the themes list, used to insert it in the right
+    // place when themes finish loading in a different order.
+    uint32_t order;
 
     struct icon_theme_t *next;
 };
@@ -53,11 +120,208 @@ enum theme_type_t {
     THEME_TYPE_FOLDER
 };
 
+#include "startup_index.c"
+
+// Returns the locations of the icon called icon_name in theme, or NULL if the
+// theme doesn't have it. Also works as a check for existence.
+// NOTE: icon_name must be an atom string.
+static inline
+struct icon_location_t* icon_theme_get_locations (struct icon_theme_t *theme, const char *icon_name)
+{
+    return atom_map_lookup (&theme->icon_names, atom_of_str (icon_name));
+}
+
+// Themes are loaded in a separate thread so the window can be shown right
+// away. The loader thread finds all themes and scans them in a thread pool,
+// each theme is pushed into the ready queue when it's done. The main thread
+// pops them from an idle callback and adds them to app.themes, which only
+// ever contains themes that finished loading.
+//
+// Nothing in a theme is modified after it's pushed into the ready queue, and
+// nothing else is shared between both threads except for the atomic counters.
+struct theme_loader_t {
+    char **path;
+    int num_paths;
+    bool notify_main_loop;
+
+    // Linked list of themes used while looking for them, then moved into
+    // the themes array, in the order they should be shown.
+    struct icon_theme_t *list;
+    struct icon_theme_t **themes;
+    int num_themes;
+
+    GThread *thread;
+    GAsyncQueue *ready;
+    gint num_found;
+    gint is_done;
+    gint is_cancelled;
+    // Set while an app_merge_ready_themes_idle() call is scheduled, so themes
+    // that finish close together are merged and shown in a single batch.
+    gint is_idle_pending;
+
+    // Only used by the main thread.
+    int num_ready;
+    bool is_done_shown;
+};
+
+// For each icon name, the set of loaded themes that have it. There is one bit
+// per theme, indexed by theme->order, and a row of words for each atom. Bits
+// are set when a theme is added to app->themes. Finding the first theme that
+// has a name is a count of trailing zeros, and counting them a popcount.
+struct icon_name_themes_t {
+    uint32_t words_per_name;
+    uint32_t num_names;
+    uint64_t *bits;
+};
+
+void icon_name_themes_init (struct icon_name_themes_t *name_themes, uint32_t num_themes)
+{
+    *name_themes = ZERO_INIT (struct icon_name_themes_t);
+    name_themes->words_per_name = MAX(1, (num_themes + 63)/64);
+}
+
+void icon_name_themes_destroy (struct icon_name_themes_t *name_themes)
+{
+    free (name_themes->bits);
+    *name_themes = ZERO_INIT (struct icon_name_themes_t);
+}
+
+static inline
+uint64_t* icon_name_themes_row (struct icon_name_themes_t *name_themes, atom_t atom)
+{
+    if (atom >= name_themes->num_names) return NULL;
+    return name_themes->bits + (size_t)atom*name_themes->words_per_name;
+}
+
+void icon_name_themes_add (struct icon_name_themes_t *name_themes, struct icon_theme_t *theme)
+{
+    atom_t max_atom = 0;
+    for (uint32_t i=0; i<theme->num_icon_names; i++) {
+        max_atom = MAX (max_atom, theme->sorted_icon_names[i]);
+    }
+
+    if (max_atom >= name_themes->num_names) {
+        uint32_t new_num_names = MAX (max_atom + 1, 2*name_themes->num_names);
+        size_t row_size = name_themes->words_per_name*sizeof(uint64_t);
+        name_themes->bits = realloc (name_themes->bits, new_num_names*row_size);
+        memset ((uint8_t*)name_themes->bits + name_themes->num_names*row_size, 0,
+                (new_num_names - name_themes->num_names)*row_size);
+        name_themes->num_names = new_num_names;
+    }
+
+    uint32_t word = theme->order/64;
+    uint64_t bit = (uint64_t)1 << (theme->order%64);
+    for (uint32_t i=0; i<theme->num_icon_names; i++) {
+        icon_name_themes_row (name_themes, theme->sorted_icon_names[i])[word] |= bit;
+    }
+}
+
+// Returns the order of the first theme that has the name, or -1.
+int icon_name_themes_first (struct icon_name_themes_t *name_themes, atom_t atom)
+{
+    uint64_t *row = icon_name_themes_row (name_themes, atom);
+    if (row == NULL) return -1;
+
+    for (uint32_t i=0; i<name_themes->words_per_name; i++) {
+        if (row[i] != 0) {
+            return i*64 + __builtin_ctzll (row[i]);
+        }
+    }
+    return -1;
+}
+
+uint32_t icon_name_themes_count (struct icon_name_themes_t *name_themes, atom_t atom)
+{
+    uint64_t *row = icon_name_themes_row (name_themes, atom);
+    if (row == NULL) return 0;
+
+    uint32_t count = 0;
+    for (uint32_t i=0; i<name_themes->words_per_name; i++) {
+        count += __builtin_popcountll (row[i]);
+    }
+    return count;
+}
+
+// Iterates the order of all themes that have a name, in increasing order:
+//
+//   struct icon_name_themes_iter_t it = icon_name_themes_iter (name_themes, atom);
+//   uint32_t order;
+//   while (icon_name_themes_next (&it, &order)) {
+//       ...
+//   }
+struct icon_name_themes_iter_t {
+    uint64_t *row;
+    uint32_t num_words;
+    uint32_t word;
+    uint64_t curr;
+};
+
+struct icon_name_themes_iter_t icon_name_themes_iter (struct icon_name_themes_t *name_themes, atom_t atom)
+{
+    struct icon_name_themes_iter_t it = ZERO_INIT (struct icon_name_themes_iter_t);
+    it.row = icon_name_themes_row (name_themes, atom);
+    if (it.row != NULL) {
+        it.num_words = name_themes->words_per_name;
+        it.curr = it.row[0];
+    }
+    return it;
+}
+
+bool icon_name_themes_next (struct icon_name_themes_iter_t *it, uint32_t *order)
+{
+    while (it->curr == 0) {
+        it->word++;
+        if (it->word >= it->num_words) return false;
+        it->curr = it->row[it->word];
+    }
+
+    *order = it->word*64 + __builtin_ctzll (it->curr);
+    it->curr &= it->curr - 1;
+    return true;
+}
+
+// Icons next to the selected one in the icon list are prefetched, so
+// stepping through the list with the arrow keys finds their images already
+// looked up and decoded. Each time a row is selected, the ICON_PREFETCH_ROWS
+// visible rows after and before it are queued, the ones in the direction the
+// selection moved first. They are processed one per idle callback, at low
+// priority so input is handled first. For each icon, its images are looked up
+// into a scratch store, probed to get their cache keys, and the ones not in
+// app.image_cache are sent to the decoder as prefetches. At most
+// ICON_PREFETCH_MAX_IMAGES are sent each time a row is selected.
+//
+// Selecting another row replaces the queue, and cancels prefetches the
+// decoder didn't start. Changing the search filter or the theme cancels
+// everything.
+#define ICON_PREFETCH_ROWS 3
+#define ICON_PREFETCH_MAX_IMAGES 48
+
+struct icon_prefetch_item_t {
+    const char *icon_name; // atom string
+    struct icon_theme_t *theme;
+
+    // Set for the folder theme, where images were already looked up.
+    struct icon_view_t *folder_view;
+};
+
+struct icon_prefetch_t {
+    guint idle_id;
+    int last_idx;
+
+    int num_items;
+    int next_item;
+    struct icon_prefetch_item_t items[2*ICON_PREFETCH_ROWS];
+    int num_images;
+
+    mem_pool_t pool;
+    struct icon_image_store_t store;
+};
+
 struct app_t {
     // App state
     struct icon_theme_t *selected_theme;
     enum theme_type_t selected_theme_type;
-    char *selected_icon;
+    const char *selected_icon; // atom string
     dvec4 bg_color;
     GtkWidget *window;
 
@@ -67,8 +331,9 @@ struct app_t {
     GtkWidget *theme_selector;
 
     // State if selected theme is THEME_TYPE_ALL
-    mem_pool_t all_icon_names_pool;
-    GTree *all_icon_names;
+    // Sorted names of all loaded themes, backs the All theme list.
+    uint32_t num_all_icon_names;
+    atom_t *all_icon_names;
     GtkWidget *all_icon_names_widget;
     const char *all_icon_names_first;
     struct fk_list_box_t all_theme_fk_list_box;
@@ -82,14 +347,74 @@ struct app_t {
 
     // Linked list head for THEME_TYPE_NORMAL themes
     struct icon_theme_t *themes;
+    struct theme_loader_t loader;
+    GtkWidget *loading_progress;
+
+    // Maximum number of threads used to scan themes at startup, 0 means use
+    // all available processors.
+    int max_scan_threads;
+
+    // Print problems found in index.theme files and exit, instead of
+    // showing the window.
+    bool diagnostics;
+
+    // Backend used to read directories when scanning themes and folders.
+    enum dir_reader_backend_t scan_backend;
+
+    // Time scanning all themes with each directory reader backend and exit.
+    bool scan_benchmark;
+
+    // Time icon name lookups in atom_map_t and GHashTable and exit.
+    bool map_benchmark;
+
+    // Time getting the size of all images of all themes from their headers,
+    // compare it with decoding them, and exit.
+    bool probe_benchmark;
+
+    // Check that pools filled by other threads are freed exactly once when
+    // adopted, and exit.
+    bool pool_selftest;
+
+    // Icon names of all themes, interned by the scanning threads.
+    struct atom_table_t atoms;
+    struct icon_name_themes_t icon_name_themes;
+
+    // Index of all themes from the previous run, mapped at startup. Themes
+    // loaded from it point into the mapped file.
+    struct startup_index_t startup_index;
+
+    // Directories listed by icon_lookup(), indexed by path.
+    GHashTable *dir_listings;
 
     // Icon view for the selected icon
     mem_pool_t icon_view_pool;
+    struct icon_image_store_t icon_view_store;
     struct icon_view_t icon_view;
 
+    // Decodes images of the shown icon view off the main thread, and keeps
+    // recently decoded ones.
+    struct image_decoder_t image_decoder;
+    struct image_cache_t image_cache;
+    size_t image_cache_budget;
+
+    // Icons next to the selected one in the icon list, that are looked up
+    // and decoded in the background.
+    struct icon_prefetch_t prefetch;
+
+    // Print hit, miss and eviction counts of image_cache on exit.
+    bool image_cache_stats;
+
     const char* valid_extensions[NUM_EXTENSIONS];
 };
 
+// Returns the first theme in app->themes that has icon_name, which must be an
+// atom string.
+struct icon_theme_t* app_first_theme_with_icon (struct app_t *app, const char *icon_name)
+{
+    int order = icon_name_themes_first (&app->icon_name_themes, atom_of_str (icon_name));
+    return order != -1 ? app->loader.themes[order] : NULL;
+}
+
 #include "icon_view.c"
 
 static inline
@@ -181,7 +506,10 @@ char *seek_next_key_value (char *c,
     }
 
     uint32_t len = 0;
-    while (*(c + len) && *(c + len) != '=' && !is_space (c)) {
+    // NOTE: Keys are matched exactly, so stop at whitespace to leave out any
+    // spaces before '=' like in "Directories = 16x16/apps".
+    while (*(c + len) && *(c + len) != '=' && !is_space (c + len) &&
+           !is_end_of_line_or_file (c + len)) {
         len++;
     }
 
@@ -190,9 +518,12 @@ char *seek_next_key_value (char *c,
 
     c = consume_spaces (c+len);
 
+    // NOTE: A line without '=' has no value, callers must skip it.
     if (*c != '=') {
         printf ("Syntax error in INI/desktop file.\n");
-        return c;
+        *value = NULL;
+        *value_len = 0;
+        return consume_line (c);
     }
 
     c++;
@@ -229,18 +560,16 @@ bool is_end_of_section (char *c)
     return *c == '[' || *c == '\0';
 }
 
-// NOTE: If multiple icons are found, ties are broken according to the order in
-// valid_extensions.
-bool fname_has_valid_extension (char *fname, size_t *icon_name_len)
+// Returns the index into valid_extensions of the extension of fname, or -1 if
+// it doesn't have a valid one.
+int fname_get_extension (char *fname, size_t *icon_name_len)
 {
-    bool ret = false;
+    int ext = -1;
     size_t len = strlen (fname);
     for (int i=0; i<ARRAY_SIZE(app.valid_extensions); i++) {
         if (g_str_has_suffix(fname, app.valid_extensions[i])) {
-            if (icon_name_len != NULL) {
-                len -= strlen (app.valid_extensions[i]);
-            }
-            ret = true;
+            len -= strlen (app.valid_extensions[i]);
+            ext = i;
             break;
         }
     }
@@ -248,277 +577,951 @@ bool fname_has_valid_extension (char *fname, size_t *icon_name_len)
     if (icon_name_len != NULL) {
         *icon_name_len = len;
     }
-    return ret;
+    return ext;
+}
+
+// NOTE: If multiple icons are found, ties are broken according to the order in
+// valid_extensions.
+bool fname_has_valid_extension (char *fname, size_t *icon_name_len)
+{
+    return fname_get_extension (fname, icon_name_len) != -1;
+}
+
+// Listing of a directory used by icon_lookup(). Maps icon names to the index
+// of their extension in valid_extensions plus 1. If the directory contains the
+// same icon with different extensions, the one with higher priority is kept.
+// It's built the first time a directory is looked into, and built again if the
+// modification time of the directory changes.
+struct dir_listing_t {
+    mem_pool_t pool;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    GHashTable *names;
+};
+
+void dir_listing_destroy (gpointer data)
+{
+    struct dir_listing_t *listing = (struct dir_listing_t*)data;
+    if (listing->names != NULL) {
+        g_hash_table_destroy (listing->names);
+    }
+    mem_pool_destroy (&listing->pool);
+    free (listing);
+}
+
+void dir_listing_build (struct dir_listing_t *listing, DIR *d)
+{
+    if (listing->names != NULL) {
+        g_hash_table_destroy (listing->names);
+    }
+    mem_pool_reset (&listing->pool);
+    listing->names = g_hash_table_new (g_str_hash, g_str_equal);
+
+    char buff[NAME_MAX+1];
+    struct dirent *entry_info;
+    while (read_dir (d, &entry_info)) {
+        size_t icon_name_len;
+        int ext = fname_get_extension (entry_info->d_name, &icon_name_len);
+        if (ext == -1) continue;
+
+        memcpy (buff, entry_info->d_name, icon_name_len);
+        buff[icon_name_len] = '\0';
+
+        gpointer orig_key, value;
+        if (g_hash_table_lookup_extended (listing->names, buff, &orig_key, &value)) {
+            if (ext + 1 < GPOINTER_TO_INT (value)) {
+                g_hash_table_insert (listing->names, orig_key, GINT_TO_POINTER (ext + 1));
+            }
+        } else {
+            char *name = pom_strndup (&listing->pool, buff, icon_name_len);
+            g_hash_table_insert (listing->names, name, GINT_TO_POINTER (ext + 1));
+        }
+    }
 }
 
+// Looks for an image for icon_name inside dir. Directories are listed once
+// into app.dir_listings, later lookups only stat() the directory to check it
+// didn't change.
 bool icon_lookup (mem_pool_t *pool, char *dir, const char *icon_name, char **found_file)
 {
+    if (app.dir_listings == NULL) {
+        app.dir_listings = g_hash_table_new_full (g_str_hash, g_str_equal, free, dir_listing_destroy);
+    }
+
     struct stat st;
-    if (stat(dir, &st) == -1 && errno == ENOENT) {
+    if (stat (dir, &st) == -1) {
         // NOTE: There are index.theme files that have entries for @2
         // directories, even though such directories do not exist in the system.
         //printf ("No directory named: %s\n", dir);
+        g_hash_table_remove (app.dir_listings, dir);
         return false;
     }
 
-    int ext_id = -1;
-    DIR *d = opendir (dir);
-    struct dirent *entry_info;
-    while (read_dir (d, &entry_info)) {
-        string_t icon_name_str = str_new(icon_name);
-        uint32_t icon_name_len = str_len(&icon_name_str);
+    struct dir_listing_t *listing = g_hash_table_lookup (app.dir_listings, dir);
+    if (listing == NULL ||
+        listing->mtime_sec != st.st_mtim.tv_sec || listing->mtime_nsec != st.st_mtim.tv_nsec) {
+        DIR *d = opendir (dir);
+        if (d == NULL) {
+            g_hash_table_remove (app.dir_listings, dir);
+            return false;
+        }
 
-        for (int i=0; i<ARRAY_SIZE(app.valid_extensions); i++) {
-            str_put_c (&icon_name_str, icon_name_len, app.valid_extensions[i]);
-            if (strcmp (str_data(&icon_name_str), entry_info->d_name) == 0) {
-                ext_id = i;
-            }
+        if (listing == NULL) {
+            listing = calloc (1, sizeof(struct dir_listing_t));
+            g_hash_table_insert (app.dir_listings, strdup (dir), listing);
         }
 
-        str_free (&icon_name_str);
+        listing->mtime_sec = st.st_mtim.tv_sec;
+        listing->mtime_nsec = st.st_mtim.tv_nsec;
+        dir_listing_build (listing, d);
+        closedir (d);
     }
-    closedir (d);
 
+    int ext_id = GPOINTER_TO_INT (g_hash_table_lookup (listing->names, icon_name)) - 1;
     if (ext_id == -1) {
         // Found no icon named icon_name
         return false;
     } else {
-        string_t found_path = str_new (dir);
-        if (str_last (&found_path) != '/') {
-            str_cat_c (&found_path, "/");
-        }
-        str_cat_c (&found_path, icon_name);
-        str_cat_c (&found_path, app.valid_extensions[ext_id]);
-
-        *found_file = mem_pool_push_size (pool, str_len(&found_path) + 1);
-        memcpy (*found_file, str_data(&found_path), str_len(&found_path) + 1);
-        str_free (&found_path);
+        bool has_slash = *dir != '\0' && dir[strlen(dir)-1] == '/';
+        *found_file = pprintf (pool, "%s%s%s%s", dir, has_slash ? "" : "/",
+                               icon_name, app.valid_extensions[ext_id]);
         return true;
     }
 }
 
-bool file_lookup (char *dir, char *file)
+templ_sort_ll(icon_theme_sort, struct icon_theme_t, strcasecmp(a->name, b->name) < 0)
+
+// Keys of index.theme files we care about. Key names are mapped to these with
+// a perfect hash, index_key_hash() gives a different value for each one of
+// them. When adding a new key, check all hashes are still different.
+enum index_key_t {
+    INDEX_KEY_UNKNOWN,
+    INDEX_KEY_NAME,
+    INDEX_KEY_DIRECTORIES,
+    INDEX_KEY_SCALED_DIRECTORIES,
+    INDEX_KEY_SIZE,
+    INDEX_KEY_MIN_SIZE,
+    INDEX_KEY_MAX_SIZE,
+    INDEX_KEY_SCALE,
+    INDEX_KEY_TYPE,
+    INDEX_KEY_CONTEXT
+};
+
+#define INDEX_KEY_HASH_SIZE 16
+
+struct index_key_slot_t {
+    const char *str;
+    enum index_key_t key;
+};
+
+static const struct index_key_slot_t index_key_slots[INDEX_KEY_HASH_SIZE] = {
+    [0]  = {"Size", INDEX_KEY_SIZE},
+    [1]  = {"Type", INDEX_KEY_TYPE},
+    [3]  = {"Name", INDEX_KEY_NAME},
+    [5]  = {"MaxSize", INDEX_KEY_MAX_SIZE},
+    [7]  = {"ScaledDirectories", INDEX_KEY_SCALED_DIRECTORIES},
+    [8]  = {"Directories", INDEX_KEY_DIRECTORIES},
+    [9]  = {"Context", INDEX_KEY_CONTEXT},
+    [11] = {"Scale", INDEX_KEY_SCALE},
+    [13] = {"MinSize", INDEX_KEY_MIN_SIZE},
+};
+
+static inline
+uint32_t index_key_hash (char *key, uint32_t key_len)
+{
+    return (key_len + (uint8_t)key[0] + (uint8_t)key[1]) & (INDEX_KEY_HASH_SIZE - 1);
+}
+
+enum index_key_t index_key_lookup (char *key, uint32_t key_len)
 {
-    struct stat st;
-    if (stat(dir, &st) == -1 && errno == ENOENT) {
-        //printf ("No directory named: %s\n", dir);
-        return 0;
+    if (key_len < 2) {
+        return INDEX_KEY_UNKNOWN;
     }
 
-    bool res = false;
-    DIR *d = opendir (dir);
-    struct dirent *entry_info;
-    while (read_dir (d, &entry_info)) {
-        uint32_t file_len = strlen(file);
-        uint32_t entry_len = strlen(entry_info->d_name);
-        int cmp = strncmp (file, entry_info->d_name, MIN (file_len, entry_len));
-        if (cmp == 0) {
-            if (file_len == entry_len) {
-                res = true;
-                break;
-            }
-        }
+    const struct index_key_slot_t *slot = &index_key_slots[index_key_hash (key, key_len)];
+    if (slot->str != NULL && strlen (slot->str) == key_len &&
+        memcmp (slot->str, key, key_len) == 0) {
+        return slot->key;
+    } else {
+        return INDEX_KEY_UNKNOWN;
     }
-    closedir (d);
-    return res;
 }
 
-templ_sort_ll(icon_theme_sort, struct icon_theme_t, strcasecmp(a->name, b->name) < 0)
-
-void set_theme_name (struct icon_theme_t *theme)
+// Parses a decimal integer that is not null terminated. On error, or if it
+// doesn't fit in an int, res is left unchanged.
+bool index_value_to_int (char *value, uint32_t value_len, int *res)
 {
-    char *c = theme->index_file;
+    while (value_len > 0 && is_space (value + value_len - 1)) {
+        value_len--;
+    }
 
-    char *section_name;
-    uint32_t section_name_len;
-    c = seek_next_section (c, &section_name, &section_name_len);
+    bool is_negative = value_len > 0 && value[0] == '-';
+    uint32_t i = is_negative ? 1 : 0;
+    if (i == value_len) {
+        return false;
+    }
 
-    char *name_str = "Name";
-    while ((c = consume_ignored_lines (c)) && *c && !is_end_of_section(c)) {
-        char *key, *value;
-        uint32_t key_len, value_len;
-        c = seek_next_key_value (c, &key, &key_len, &value, &value_len);
-        if (strlen (name_str) == key_len && strncmp (name_str, key, key_len) == 0) {
-            theme->name = pom_push_size (&theme->pool, value_len+1);
-            memcpy (theme->name, value, value_len);
-            theme->name[value_len] = '\0';
+    int64_t n = 0;
+    for (; i<value_len; i++) {
+        if (value[i] < '0' || value[i] > '9') {
+            return false;
+        }
+        n = 10*n + value[i] - '0';
+        if (n > INT_MAX) {
+            return false;
         }
-
     }
+
+    *res = is_negative ? -n : n;
+    return true;
 }
 
-struct icon_theme_t* app_icon_theme_new (struct app_t *app)
+// Iterates the comma separated list of directories in the value of a
+// Directories or ScaledDirectories key. Spaces around items and trailing '/'
+// are ignored, as are empty items.
+bool index_dir_list_next (char **c, char *end, char **item, uint32_t *item_len)
 {
-    mem_pool_t bootstrap = {0};
-    struct icon_theme_t *new_icon_theme = mem_pool_push_size (&bootstrap, sizeof(struct icon_theme_t));
-    *new_icon_theme = ZERO_INIT (struct icon_theme_t);
-    new_icon_theme->pool = bootstrap;
+    while (*c < end) {
+        char *start = *c;
+        while (*c < end && **c != ',') {
+            (*c)++;
+        }
 
-    new_icon_theme->next = app->themes;
-    app->themes = new_icon_theme;
-    return new_icon_theme;
-}
+        char *item_end = *c;
+        if (*c < end) {
+            (*c)++;
+        }
 
-void icon_theme_destroy (struct icon_theme_t *icon_theme)
-{
-    if (icon_theme->icon_names != NULL)
-        g_hash_table_destroy (icon_theme->icon_names);
-    mem_pool_destroy (&icon_theme->pool);
-}
+        while (start < item_end && is_space (start)) {
+            start++;
+        }
+        while (item_end > start && (is_space (item_end-1) || *(item_end-1) == '/')) {
+            item_end--;
+        }
 
-// I have to find this information directly from the icon directories and
-// index.theme files. The alternative of using GtkIconTheme with a custom theme
-// and then calling gtk_icon_theme_list_icons() on it does not only return icons
-// from the chosen theme. Instead it also includes:
-//
-//      * Unthemed icons
-//      * Deprecated stock id's (see GTK/testsuite/gtk/check-icon-names.c)
-//      * Internal icons (see GTK/testsuite/gtk/check-icon-names.c)
-//      * All icons from Hicolor, GNOME and Adwaita themes
-//
-// I expected Hicolor icons to be there because it's the fallback theme, but I
-// didn't expect any of the rest. All this is probably done for backward
-// compatibility reasons but it does not work for what we want.
-void set_theme_icon_names (struct icon_theme_t *theme)
-{
-  theme->icon_names = g_hash_table_new (g_str_hash, g_str_equal);
+        if (item_end > start) {
+            *item = start;
+            *item_len = item_end - start;
+            return true;
+        }
+    }
 
-  if (theme->dir_name != NULL) {
-      int i;
-      for (i=0; i<theme->num_dirs; i++) {
-          char *c = theme->index_file;
-
-          // Ignore the first section: [Icon Theme]
-          c = seek_next_section (c, NULL, NULL);
-          c = consume_section (c);
-
-          string_t theme_dir = str_new (theme->dirs[i]);
-          str_cat_c (&theme_dir, "/");
-          uint32_t theme_dir_len = str_len (&theme_dir);
-          while ((c = consume_section (c)) && *c) {
-              char *section_name;
-              uint32_t section_name_len;
-              c = seek_next_section (c, &section_name, &section_name_len);
-              string_t curr_dir = strn_new (section_name, section_name_len);
-              str_put (&theme_dir, theme_dir_len, &curr_dir);
-              if (section_name[section_name_len-1] != '/') {
-                  str_cat_c (&theme_dir, "/");
-              }
-              uint32_t curr_dir_len = str_len (&theme_dir);
+    return false;
+}
 
-              struct stat st;
-              if (stat(str_data(&theme_dir), &st) == -1 && errno == ENOENT) {
-                  continue;
-              }
+struct index_dir_lists_t {
+    char *value[2];
+    uint32_t value_len[2];
+};
 
-              DIR *d = opendir (str_data(&theme_dir));
-              struct dirent *entry_info;
-              while (read_dir (d, &entry_info)) {
-                  if (entry_info->d_name[0] != '.') {
-                      str_put_c (&theme_dir, curr_dir_len, entry_info->d_name);
-                      size_t icon_name_len;
-                      if (stat(str_data(&theme_dir), &st) == 0 &&
-                          S_ISREG(st.st_mode) &&
-                          fname_has_valid_extension (entry_info->d_name, &icon_name_len)) {
-                          char *icon_name = pom_strndup (&theme->pool, entry_info->d_name, icon_name_len);
-                          g_hash_table_insert (theme->icon_names, icon_name, NULL);
-                      }
-                  }
-              }
-              closedir (d);
-          }
-      }
+#define index_dir_lists_foreach(lists,item,item_len)                                \
+    for (int _list_idx=0; _list_idx<ARRAY_SIZE((lists)->value); _list_idx++)        \
+        for (char *_c = (lists)->value[_list_idx],                                  \
+                  *_end = _c + (lists)->value_len[_list_idx];                       \
+             _c != NULL && index_dir_list_next (&_c, _end, &item, &item_len);)
 
-  } else {
-      // This is the case for non themed icons.
-      int i;
-      for (i=0; i<theme->num_dirs; i++) {
-        string_t path_str = str_new (theme->dirs[i]);
-        if (str_last(&path_str) != '/') {
-            str_cat_c (&path_str, "/");
-        }
-        uint32_t path_len = str_len (&path_str);
+// Reads the [Icon Theme] section. Sets the theme's name if it doesn't have one
+// yet, and the values of the Directories and ScaledDirectories keys.
+char* icon_theme_parse_header (struct icon_theme_t *theme, char *c, struct index_dir_lists_t *lists)
+{
+    *lists = ZERO_INIT (struct index_dir_lists_t);
 
-        DIR *d = opendir (str_data(&path_str));
-        struct dirent *entry_info;
-        while (read_dir (d, &entry_info)) {
-            struct stat st;
-            str_put_c (&path_str, path_len, entry_info->d_name);
+    c = seek_next_section (c, NULL, NULL);
+    while ((c = consume_ignored_lines (c)) && !is_end_of_section(c)) {
+        char *key, *value;
+        uint32_t key_len, value_len;
+        c = seek_next_key_value (c, &key, &key_len, &value, &value_len);
+        if (value == NULL) {
+            continue;
+        }
 
-            if (stat(str_data(&path_str), &st) == 0 && S_ISREG(st.st_mode)) {
-                size_t icon_name_len;
-                if (fname_has_valid_extension(entry_info->d_name, &icon_name_len)) {
-                    char *icon_name = pom_strndup (&theme->pool, entry_info->d_name, icon_name_len);
-                    g_hash_table_insert (theme->icon_names, icon_name, NULL);
+        switch (index_key_lookup (key, key_len)) {
+            case INDEX_KEY_NAME:
+                if (theme->name == NULL) {
+                    theme->name = pom_strndup (&theme->pool, value, value_len);
                 }
-            }
+                break;
+            case INDEX_KEY_DIRECTORIES:
+                lists->value[0] = value;
+                lists->value_len[0] = value_len;
+                break;
+            case INDEX_KEY_SCALED_DIRECTORIES:
+                lists->value[1] = value;
+                lists->value_len[1] = value_len;
+                break;
+            default:
+                break;
         }
-        str_free (&path_str);
-        closedir (d);
-      }
-  }
-}
+    }
 
-gint strcase_cmp_callback (gconstpointer a, gconstpointer b)
-{
-    return g_ascii_strcasecmp ((const char*)a, (const char*)b);
+    return c;
 }
 
-// This is case sensitive but will sort correctly strings with different cases
-// into alphabetical order AaBbCc not ABCabc.
-gint str_cmp_callback (gconstpointer a, gconstpointer b)
+// Reads theme->index_file once, and stores the directories of the theme in
+// theme->sections. Code that needs information about a directory should use
+// these instead of parsing the index file again. If the theme has no name yet,
+// it's also set from the Name key.
+//
+// Directories of a theme are the ones listed in the Directories and
+// ScaledDirectories keys, each one is stored once, in the order they are
+// listed. Sections not listed there are ignored, listed directories without a
+// section too. Some themes (Oxygen) repeat sections, like GKeyFile does, we
+// merge them with later keys replacing earlier ones. Themes without any of
+// these keys are broken, for them we use all sections so there is something
+// to look at.
+void icon_theme_parse_index_file (struct icon_theme_t *theme)
 {
-    int cmp = g_ascii_strcasecmp ((const char*)a, (const char*)b);
-    if (cmp == 0) {
-        return g_strcmp0 ((const char*)a, (const char*)b);
-    } else {
-        return cmp;
+    theme->num_sections = 0;
+    theme->sections = NULL;
+    if (theme->index_file == NULL) {
+        return;
     }
-}
 
-void app_load_all_icon_themes (struct app_t *app)
-{
-    GtkIconTheme *icon_theme = gtk_icon_theme_get_default ();
-    gchar **path;
-    gint num_paths;
-    gtk_icon_theme_get_search_path (icon_theme, &path, &num_paths);
+    mem_pool_t pool = {0};
+    char *c = theme->index_file;
 
-    // Locate all index.theme files that are in the search paths, and append a
-    // new icon_theme_t struct for each one.
-    int i;
-    for (i=0; i<num_paths; i++) {
-        char *curr_search_path = abs_path(path[i], NULL);
-        struct stat st;
-        if (curr_search_path != NULL && (stat(curr_search_path, &st) != -1 || errno != ENOENT)) {
-            string_t path_str = str_new (curr_search_path);
-            if (str_last(&path_str) != '/') {
-                str_cat_c (&path_str, "/");
-            }
-            uint32_t path_len = str_len (&path_str);
+    uint32_t max_sections = 0;
+    while (*(c = consume_section (c))) {
+        c = seek_next_section (c, NULL, NULL);
+        max_sections++;
+    }
 
-            DIR *d = opendir (curr_search_path);
-            struct dirent *entry_info;
-            while (read_dir (d, &entry_info)) {
-                if (strcmp ("default", entry_info->d_name) != 0 && entry_info->d_name[0] != '.') {
-                    string_t theme_dir = str_new (entry_info->d_name);
-                    str_put (&path_str, path_len, &theme_dir);
+    struct index_dir_lists_t lists;
+    c = icon_theme_parse_header (theme, theme->index_file, &lists);
+    bool use_all_sections = lists.value[0] == NULL && lists.value[1] == NULL;
 
-                    if (stat(str_data(&path_str), &st) == 0 && S_ISDIR(st.st_mode) &&
-                        file_lookup (str_data(&path_str), "index.theme")) {
+    char *item;
+    uint32_t item_len;
+    index_dir_lists_foreach (&lists, item, item_len) {
+        max_sections++;
+    }
 
-                        struct icon_theme_t *theme = app_icon_theme_new (app);
-                        theme->dir_name = pom_strdup (&theme->pool, entry_info->d_name);
+    theme->sections = mem_pool_push_array (&theme->pool, max_sections, struct theme_section_t);
+
+    // Maps directory names to their index in theme->sections plus 1.
+    GHashTable *section_ids = g_hash_table_new (g_str_hash, g_str_equal);
+    bool *has_section = mem_pool_push_array (&pool, max_sections, bool);
+    memset (has_section, 0, max_sections*sizeof(bool));
+
+    index_dir_lists_foreach (&lists, item, item_len) {
+        char *name = pom_strndup (&theme->pool, item, item_len);
+        if (!g_hash_table_contains (section_ids, name)) {
+            struct theme_section_t *section = &theme->sections[theme->num_sections++];
+            *section = ZERO_INIT (struct theme_section_t);
+            section->name = name;
+            section->name_len = item_len;
+            section->size = -1;
+            section->min_size = -1;
+            section->max_size = -1;
+            section->scale = 1;
+
+            // NOTE: We say an image is scalable if dir contains the substring
+            // "scalable" as this is what developers seem to use. The index
+            // file may disagree, and Gtk for example makes any .svg icon
+            // 'scalable' no matter what the index file or dir says.
+            section->is_scalable = strstr (section->name, "scalable") != NULL;
+
+            g_hash_table_insert (section_ids, name, GUINT_TO_POINTER(theme->num_sections));
+        }
+    }
 
-                        str_cat_c (&path_str, "/index.theme");
-                        theme->index_file = full_file_read (&theme->pool, str_data(&path_str), NULL);
-                        set_theme_name(theme);
+    while ((c = consume_section (c)) && *c) {
+        char *section_name = NULL;
+        uint32_t section_name_len = 0;
+        c = seek_next_section (c, &section_name, &section_name_len);
+        if (section_name == NULL) {
+            continue;
+        }
+
+        while (section_name_len > 0 && section_name[section_name_len-1] == '/') {
+            section_name_len--;
+        }
+
+        mem_pool_marker_t mrkr = mem_pool_begin_temporary_memory (&pool);
+        char *name = pom_strndup (&pool, section_name, section_name_len);
+        uint32_t id = GPOINTER_TO_UINT (g_hash_table_lookup (section_ids, name));
+        mem_pool_end_temporary_memory (mrkr);
+
+        if (id == 0 && use_all_sections && theme->num_sections < max_sections) {
+            struct theme_section_t *section = &theme->sections[theme->num_sections++];
+            *section = ZERO_INIT (struct theme_section_t);
+            section->name = pom_strndup (&theme->pool, section_name, section_name_len);
+            section->name_len = section_name_len;
+            section->size = -1;
+            section->min_size = -1;
+            section->max_size = -1;
+            section->scale = 1;
+            section->is_scalable = strstr (section->name, "scalable") != NULL;
+
+            id = theme->num_sections;
+            g_hash_table_insert (section_ids, section->name, GUINT_TO_POINTER(id));
+        }
+
+        if (id == 0) {
+            continue;
+        }
+
+        struct theme_section_t *section = &theme->sections[id-1];
+        has_section[id-1] = true;
+
+        while ((c = consume_ignored_lines (c)) && !is_end_of_section(c)) {
+            char *key, *value;
+            uint32_t key_len, value_len;
+            c = seek_next_key_value (c, &key, &key_len, &value, &value_len);
+            if (value == NULL) {
+                continue;
+            }
+
+            switch (index_key_lookup (key, key_len)) {
+                case INDEX_KEY_SIZE:
+                    index_value_to_int (value, value_len, &section->size);
+                    break;
+                case INDEX_KEY_MIN_SIZE:
+                    index_value_to_int (value, value_len, &section->min_size);
+                    break;
+                case INDEX_KEY_MAX_SIZE:
+                    index_value_to_int (value, value_len, &section->max_size);
+                    break;
+                case INDEX_KEY_SCALE:
+                    index_value_to_int (value, value_len, &section->scale);
+                    break;
+                case INDEX_KEY_TYPE:
+                    section->type = pom_strndup (&theme->pool, value, value_len);
+                    break;
+                case INDEX_KEY_CONTEXT:
+                    section->context = pom_strndup (&theme->pool, value, value_len);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    // Remove listed directories that have no section.
+    uint32_t num_sections = 0;
+    for (uint32_t i=0; i<theme->num_sections; i++) {
+        if (has_section[i]) {
+            theme->sections[num_sections++] = theme->sections[i];
+        }
+    }
+    theme->num_sections = num_sections;
+
+    g_hash_table_destroy (section_ids);
+    mem_pool_destroy (&pool);
+}
+
+// Prints everything in the index file of theme that doesn't match the set of
+// directories we use. The sections that are listed twice, sections not listed
+// in Directories or ScaledDirectories, and listed directories that don't have
+// a section.
+void icon_theme_print_diagnostics (struct icon_theme_t *theme)
+{
+    if (theme->index_file == NULL) {
+        return;
+    }
+
+    printf ("%s (%s)\n", theme->name, theme->index_file_path != NULL ? theme->index_file_path : theme->dir_name);
+
+    mem_pool_t pool = {0};
+    GHashTable *seen = g_hash_table_new (g_str_hash, g_str_equal);
+    GHashTable *listed = g_hash_table_new (g_str_hash, g_str_equal);
+    uint32_t num_problems = 0;
+
+    struct index_dir_lists_t lists;
+    char *c = icon_theme_parse_header (theme, theme->index_file, &lists);
+    if (lists.value[0] == NULL && lists.value[1] == NULL) {
+        printf ("  No Directories or ScaledDirectories key, using all sections.\n");
+        num_problems++;
+    }
+
+    char *item;
+    uint32_t item_len;
+    index_dir_lists_foreach (&lists, item, item_len) {
+        char *name = pom_strndup (&pool, item, item_len);
+        if (g_hash_table_contains (listed, name)) {
+            printf ("  Directory '%s' is listed more than once.\n", name);
+            num_problems++;
+        }
+        g_hash_table_insert (listed, name, NULL);
+    }
+
+    while ((c = consume_section (c)) && *c) {
+        char *section_name = NULL;
+        uint32_t section_name_len = 0;
+        c = seek_next_section (c, &section_name, &section_name_len);
+        if (section_name == NULL) {
+            continue;
+        }
+
+        while (section_name_len > 0 && section_name[section_name_len-1] == '/') {
+            section_name_len--;
+        }
+
+        char *name = pom_strndup (&pool, section_name, section_name_len);
+        if (g_hash_table_contains (seen, name)) {
+            printf ("  Section [%s] is repeated.\n", name);
+            num_problems++;
+
+        } else if (!g_hash_table_contains (listed, name) && g_hash_table_size (listed) > 0) {
+            printf ("  Section [%s] is not in Directories or ScaledDirectories, ignored.\n", name);
+            num_problems++;
+        }
+        g_hash_table_insert (seen, name, NULL);
+    }
+
+    index_dir_lists_foreach (&lists, item, item_len) {
+        char *name = pom_strndup (&pool, item, item_len);
+        if (!g_hash_table_contains (seen, name)) {
+            printf ("  Directory '%s' has no section, ignored.\n", name);
+            num_problems++;
+            g_hash_table_insert (seen, name, NULL);
+        }
+    }
+
+    printf ("  %u directories used, %u problems.\n", theme->num_sections, num_problems);
+
+    g_hash_table_destroy (seen);
+    g_hash_table_destroy (listed);
+    mem_pool_destroy (&pool);
+}
+
+struct icon_theme_t* icon_theme_new (struct icon_theme_t **list)
+{
+    mem_pool_t bootstrap = {0};
+    struct icon_theme_t *new_icon_theme = mem_pool_push_size (&bootstrap, sizeof(struct icon_theme_t));
+    *new_icon_theme = ZERO_INIT (struct icon_theme_t);
+    new_icon_theme->pool = bootstrap;
+
+    new_icon_theme->next = *list;
+    *list = new_icon_theme;
+    return new_icon_theme;
+}
+
+void icon_theme_destroy (struct icon_theme_t *icon_theme)
+{
+    if (icon_theme->scan_icon_names != NULL)
+        g_hash_table_destroy (icon_theme->scan_icon_names);
+    mem_pool_destroy (&icon_theme->pool);
+}
+
+// Records that there is an image for the icon called name (name_len bytes long,
+// not null terminated). If is_persistent is true, name must be null terminated
+// at name_len and live as long as the theme, then it's not copied.
+void icon_theme_add_location (struct icon_theme_t *theme,
+                              char *name, size_t name_len, bool is_persistent,
+                              uint16_t dir, uint16_t section, uint8_t ext)
+{
+    char buff[NAME_MAX+1];
+    char *key = name;
+    if (!is_persistent) {
+        if (name_len > NAME_MAX) return;
+        memcpy (buff, name, name_len);
+        buff[name_len] = '\0';
+        key = buff;
+    }
+
+    gpointer orig_key, value;
+    struct icon_location_t *locations = NULL;
+    if (g_hash_table_lookup_extended (theme->scan_icon_names, key, &orig_key, &value)) {
+        locations = value;
+        for (struct icon_location_t *l = locations; l != NULL; l = l->next) {
+            if (l->dir == dir && l->section == section) {
+                l->ext = MIN (l->ext, ext);
+                return;
+            }
+        }
+        key = orig_key;
+
+    } else if (!is_persistent) {
+        key = pom_strndup (theme->scan_pool, name, name_len);
+    }
+
+    struct icon_location_t *new_location = mem_pool_push_size (&theme->pool, sizeof(struct icon_location_t));
+    new_location->dir = dir;
+    new_location->section = section;
+    new_location->ext = ext;
+    new_location->next = locations;
+    g_hash_table_insert (theme->scan_icon_names, key, new_location);
+}
+
+// Fills theme->scan_icon_names using the icon-theme.cache file inside dir, if there
+// is one and it's up to date. As in the directory walk, only images inside
+// directories that have a section in index.theme are considered. Names are not
+// copied, they point into the mapped cache file which stays mapped until the
+// theme's scan pool is reset.
+bool set_theme_icon_names_from_cache (struct icon_theme_t *theme, uint32_t dir)
+{
+    struct gtk_icon_cache_t cache;
+    if (!gtk_icon_cache_map (theme->scan_pool, theme->dirs[dir], &cache)) {
+        return false;
+    }
+
+    // Maps directories in the cache to the index of their section, or -1.
+    mem_pool_t pool = {0};
+    int32_t *section_idx = mem_pool_push_array (&pool, cache.num_dirs, int32_t);
+    for (uint32_t i=0; i<cache.num_dirs; i++) {
+        section_idx[i] = -1;
+    }
+
+    for (uint32_t j=0; j<theme->num_sections; j++) {
+        struct theme_section_t *section = &theme->sections[j];
+        for (uint32_t i=0; i<cache.num_dirs; i++) {
+            char *dir_name = gtk_icon_cache_dir_name (&cache, i);
+            if (dir_name != NULL && strcmp (dir_name, section->name) == 0) {
+                section_idx[i] = j;
+            }
+        }
+    }
+
+    struct gtk_icon_cache_iter_t it = gtk_icon_cache_iter (&cache);
+    char *name;
+    uint16_t dir_idx, flags;
+    while (gtk_icon_cache_next_image (&it, &name, &dir_idx, &flags)) {
+        if (dir_idx >= cache.num_dirs || section_idx[dir_idx] == -1) continue;
+        uint16_t section = section_idx[dir_idx];
+        size_t name_len = strlen (name);
+
+        if (flags & GTK_ICON_CACHE_HAS_SUFFIX_SVG) {
+            icon_theme_add_location (theme, name, name_len, true, dir, section, EXT_SVG);
+        } else if (flags & GTK_ICON_CACHE_HAS_SUFFIX_XPM) {
+            icon_theme_add_location (theme, name, name_len, true, dir, section, EXT_XPM);
+        }
+
+        if (flags & GTK_ICON_CACHE_HAS_SUFFIX_PNG) {
+            // The cache only strips the last extension, but we consider
+            // .symbolic.png to be a single extension.
+            size_t symbolic_len = strlen (".symbolic");
+            if (g_str_has_suffix (name, ".symbolic")) {
+                icon_theme_add_location (theme, name, name_len - symbolic_len, false,
+                                         dir, section, EXT_SYMBOLIC_PNG);
+            } else {
+                icon_theme_add_location (theme, name, name_len, true, dir, section, EXT_PNG);
+            }
+        }
+    }
+
+    mem_pool_destroy (&pool);
+    return true;
+}
+
+// I have to find this information directly from the icon directories and
+// index.theme files. The alternative of using GtkIconTheme with a custom theme
+// and then calling gtk_icon_theme_list_icons() on it does not only return icons
+// from the chosen theme. Instead it also includes:
+//
+//      * Unthemed icons
+//      * Deprecated stock id's (see GTK/testsuite/gtk/check-icon-names.c)
+//      * Internal icons (see GTK/testsuite/gtk/check-icon-names.c)
+//      * All icons from Hicolor, GNOME and Adwaita themes
+//
+// I expected Hicolor icons to be there because it's the fallback theme, but I
+// didn't expect any of the rest. All this is probably done for backward
+// compatibility reasons but it does not work for what we want.
+//
+// Directories are read with the passed dir_reader_t backend. If use_cache is
+// false, icon-theme.cache files are ignored and all directories are read, this
+// is only useful to benchmark the directory walk.
+void set_theme_icon_names_full (struct icon_theme_t *theme,
+                                enum dir_reader_backend_t backend, bool use_cache)
+{
+  theme->scan_icon_names = g_hash_table_new (g_str_hash, g_str_equal);
+  // The scan pool of a thread is reused for all themes it scans, and big
+  // themes copy hundreds of KB of names into it. Themes are scanned by the
+  // loader thread or by an exclusive thread pool, both exit when loading ends
+  // and destroy their pools, so huge page bins only live during the scan.
+  theme->scan_pool = mem_pool_thread_local ();
+  theme->scan_pool->use_huge_pages = true;
+  struct dir_reader_t reader = {0};
+
+  if (theme->dir_name != NULL) {
+      int i;
+      for (i=0; i<theme->num_dirs; i++) {
+          if (use_cache && set_theme_icon_names_from_cache (theme, i)) {
+              continue;
+          }
+
+          struct path_builder_t theme_dir;
+          if (!path_builder_set (&theme_dir, theme->dirs[i]) || !path_builder_push (&theme_dir, "")) {
+              continue;
+          }
+          uint32_t theme_dir_len = theme_dir.len;
+          for (uint32_t j=0; j<theme->num_sections; j++) {
+              struct theme_section_t *section = &theme->sections[j];
+              path_builder_truncate (&theme_dir, theme_dir_len);
+
+              // NOTE: Sections for directories that don't exist are common,
+              // failing to open them is how we detect them.
+              if (!path_builder_push_n (&theme_dir, section->name, section->name_len) ||
+                  !dir_reader_open (&reader, theme_dir.str, backend)) {
+                  continue;
+              }
+
+              struct dirent *entry_info;
+              while (dir_reader_next (&reader, &entry_info)) {
+                  size_t icon_name_len;
+                  int ext;
+                  if (entry_info->d_name[0] != '.' &&
+                      (ext = fname_get_extension (entry_info->d_name, &icon_name_len)) != -1 &&
+                      dir_entry_is_reg (dir_reader_fd(&reader), entry_info)) {
+                      icon_theme_add_location (theme, entry_info->d_name, icon_name_len, false, i, j, ext);
+                  }
+              }
+              dir_reader_close (&reader);
+          }
+      }
+
+  } else {
+      // This is the case for non themed icons.
+      int i;
+      for (i=0; i<theme->num_dirs; i++) {
+        if (!dir_reader_open (&reader, theme->dirs[i], backend)) {
+            continue;
+        }
+
+        struct dirent *entry_info;
+        while (dir_reader_next (&reader, &entry_info)) {
+            size_t icon_name_len;
+            int ext;
+            if ((ext = fname_get_extension (entry_info->d_name, &icon_name_len)) != -1 &&
+                dir_entry_is_reg (dir_reader_fd(&reader), entry_info)) {
+                icon_theme_add_location (theme, entry_info->d_name, icon_name_len, false,
+                                         i, ICON_LOCATION_NO_SECTION, ext);
+            }
+        }
+        dir_reader_close (&reader);
+      }
+  }
+
+  dir_reader_destroy (&reader);
+}
+
+void set_theme_icon_names (struct icon_theme_t *theme)
+{
+    set_theme_icon_names_full (theme, app.scan_backend, true);
+}
+
+// Stamps everything set_theme_icon_names() reads. Must be called before
+// scanning, so changes made while scanning invalidate the stamps next time.
+//
+// NOTE: The first stamp is always the index.theme file, if the theme has one.
+void icon_theme_compute_stamps (struct icon_theme_t *theme)
+{
+    uint32_t max_stamps = 1 + theme->num_dirs*(1 + theme->num_sections);
+    theme->stamps = mem_pool_push_array (&theme->pool, max_stamps, struct file_stamp_t);
+    theme->num_stamps = 0;
+
+    if (theme->index_file_path != NULL) {
+        struct file_stamp_t *stamp = &theme->stamps[theme->num_stamps++];
+        stamp->path = theme->index_file_path;
+        file_stamp_get (stamp->path, &stamp->mtime_sec, &stamp->mtime_nsec);
+    }
+
+    for (int i=0; i<theme->num_dirs; i++) {
+        struct file_stamp_t *stamp = &theme->stamps[theme->num_stamps++];
+        stamp->path = theme->dirs[i];
+        file_stamp_get (stamp->path, &stamp->mtime_sec, &stamp->mtime_nsec);
+
+        struct path_builder_t theme_dir;
+        if (theme->index_file != NULL &&
+            path_builder_set (&theme_dir, theme->dirs[i]) && path_builder_push (&theme_dir, "")) {
+            uint32_t theme_dir_len = theme_dir.len;
+            for (uint32_t j=0; j<theme->num_sections; j++) {
+                struct theme_section_t *section = &theme->sections[j];
+                path_builder_truncate (&theme_dir, theme_dir_len);
+                if (!path_builder_push_n (&theme_dir, section->name, section->name_len)) {
+                    continue;
+                }
+
+                stamp = &theme->stamps[theme->num_stamps++];
+                stamp->path = pom_strndup (&theme->pool, theme_dir.str, theme_dir.len);
+                file_stamp_get (stamp->path, &stamp->mtime_sec, &stamp->mtime_nsec);
+            }
+        }
+    }
+}
+
+// This is case sensitive but will sort correctly strings with different cases
+// into alphabetical order AaBbCc not ABCabc.
+gint str_cmp_callback (gconstpointer a, gconstpointer b)
+{
+    int cmp = g_ascii_strcasecmp ((const char*)a, (const char*)b);
+    if (cmp == 0) {
+        return g_strcmp0 ((const char*)a, (const char*)b);
+    } else {
+        return cmp;
+    }
+}
+
+// Builds theme->icon_names from the string keyed theme->scan_icon_names, all
+// names of the theme are interned in a single batch. After this nothing
+// points into the scan pool anymore, so it's reset.
+void icon_theme_intern_icon_names (struct atom_table_t *atoms, struct icon_theme_t *theme)
+{
+    uint32_t num_names = g_hash_table_size (theme->scan_icon_names);
+    atom_map_init (&theme->pool, &theme->icon_names, num_names);
+    theme->sorted_icon_names = mem_pool_push_array (&theme->pool, num_names, atom_t);
+    theme->num_icon_names = 0;
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init (&iter, theme->scan_icon_names);
+    atom_table_lock (atoms);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        atom_t atom = atom_intern_locked (atoms, key);
+        if (atom != ATOM_NULL) {
+            atom_map_insert (&theme->icon_names, atom, value);
+            theme->sorted_icon_names[theme->num_icon_names++] = atom;
+        }
+    }
+    atom_table_unlock (atoms);
+
+    atom_sort (atoms, theme->sorted_icon_names, theme->num_icon_names);
+
+    g_hash_table_destroy (theme->scan_icon_names);
+    theme->scan_icon_names = NULL;
+
+    if (theme->scan_pool != NULL) {
+        mem_pool_reset (theme->scan_pool);
+        theme->scan_pool = NULL;
+    }
+}
+
+// Loads the icon names of a theme from the startup index if nothing changed
+// since it was written, otherwise scans the theme.
+void icon_theme_load_icon_names (struct startup_index_t *index, struct atom_table_t *atoms,
+                                 struct icon_theme_t *theme)
+{
+    if (!startup_index_theme_load (index, theme)) {
+        icon_theme_compute_stamps (theme);
+        set_theme_icon_names (theme);
+        theme->scanned = true;
+    }
+    icon_theme_intern_icon_names (atoms, theme);
+}
+
+// Scanning a theme only touches its own pools and scan_icon_names table, so
+// themes can be scanned in parallel. The number of sections in index.theme
+// times the number of directories the theme is spread across is used as an
+// estimate of how long it will take. Pushing the most expensive themes first
+// avoids ending up waiting for a single thread scanning a huge theme (like
+// Papirus) after all other threads are done.
+struct theme_scan_job_t {
+    struct icon_theme_t *theme;
+    uint32_t cost;
+};
+
+templ_sort(theme_scan_job_sort, struct theme_scan_job_t, a->cost > b->cost)
+
+uint32_t theme_scan_cost (struct icon_theme_t *theme)
+{
+    return MAX(theme->num_sections, 1)*MAX(theme->num_dirs, 1);
+}
+
+gboolean app_merge_ready_themes_idle (gpointer user_data);
+
+// Schedules merging ready themes from the main loop, unless it's already
+// scheduled. Can be called from any thread.
+void app_notify_ready_themes (struct app_t *app)
+{
+    if (app->loader.notify_main_loop &&
+        g_atomic_int_compare_and_exchange (&app->loader.is_idle_pending, 0, 1)) {
+        g_idle_add (app_merge_ready_themes_idle, app);
+    }
+}
+
+// Called from the loader's threads when a theme finished loading.
+void app_push_ready_theme (struct app_t *app, struct icon_theme_t *theme)
+{
+    g_async_queue_push (app->loader.ready, theme);
+    app_notify_ready_themes (app);
+}
+
+void set_theme_icon_names_job (gpointer data, gpointer user_data)
+{
+    struct app_t *app = (struct app_t*)user_data;
+    struct icon_theme_t *theme = (struct icon_theme_t*)data;
+
+    if (!g_atomic_int_get (&app->loader.is_cancelled)) {
+        icon_theme_load_icon_names (&app->startup_index, &app->atoms, theme);
+    }
+    app_push_ready_theme (app, theme);
+}
+
+void app_scan_themes_parallel (struct app_t *app)
+{
+    int num_themes = app->loader.num_themes;
+
+    mem_pool_t pool = {0};
+    struct theme_scan_job_t *jobs = mem_pool_push_array (&pool, num_themes, struct theme_scan_job_t);
+    int i;
+    for (i=0; i<num_themes; i++) {
+        jobs[i].theme = app->loader.themes[i];
+        jobs[i].cost = theme_scan_cost (jobs[i].theme);
+    }
+    theme_scan_job_sort (jobs, num_themes);
+
+    int num_threads = app->max_scan_threads > 0 ? app->max_scan_threads : g_get_num_processors ();
+    num_threads = MIN (num_threads, num_themes);
+
+    if (num_threads <= 1) {
+        for (i=0; i<num_themes; i++) {
+            set_theme_icon_names_job (jobs[i].theme, app);
+        }
+
+    } else {
+        GThreadPool *scan_pool =
+            g_thread_pool_new (set_theme_icon_names_job, app, num_threads, TRUE, NULL);
+        for (i=0; i<num_themes; i++) {
+            g_thread_pool_push (scan_pool, jobs[i].theme, NULL);
+        }
+
+        // Wait for all jobs to finish before returning.
+        g_thread_pool_free (scan_pool, FALSE, TRUE);
+    }
+
+    mem_pool_destroy (&pool);
+}
+
+// Finds all themes by looking into the search paths. If the startup index
+// contains a theme with the same directories as a found one, it's set as its
+// index_record so it doesn't need to be scanned if it didn't change.
+void app_find_icon_themes (struct app_t *app, char **path, int num_paths)
+{
+    // Locate all index.theme files that are in the search paths, and append a
+    // new icon_theme_t struct for each one.
+    int i;
+    for (i=0; i<num_paths; i++) {
+        char *curr_search_path = abs_path(path[i], NULL);
+        struct stat st;
+        if (curr_search_path != NULL && (stat(curr_search_path, &st) != -1 || errno != ENOENT)) {
+            struct path_builder_t path_str;
+            path_builder_set (&path_str, curr_search_path);
+            path_builder_push (&path_str, "");
+            uint32_t path_len = path_str.len;
+
+            DIR *d = opendir (curr_search_path);
+            struct dirent *entry_info;
+            while (d != NULL && read_dir (d, &entry_info)) {
+                if (strcmp ("default", entry_info->d_name) != 0 && entry_info->d_name[0] != '.') {
+                    path_builder_truncate (&path_str, path_len);
+
+                    // NOTE: If index.theme exists then the entry is a
+                    // directory, no need to check it separately.
+                    if (path_builder_push (&path_str, entry_info->d_name) &&
+                        path_builder_push (&path_str, "index.theme") &&
+                        file_exists_at (dirfd(d), path_str.str + path_len)) {
+                        struct icon_theme_t *theme = icon_theme_new (&app->loader.list);
+                        theme->dir_name = pom_strdup (&theme->pool, entry_info->d_name);
+                        theme->index_file_path = pom_strndup (&theme->pool, path_str.str, path_str.len);
+                        theme->index_file = full_file_read (&theme->pool, theme->index_file_path, NULL);
+                        icon_theme_parse_index_file (theme);
                     }
-                    str_free (&theme_dir);
                 }
             }
 
-            closedir (d);
-            str_free (&path_str);
+            if (d != NULL) {
+                closedir (d);
+            }
 
         } else {
             // curr_search_path does not exist.
@@ -530,24 +1533,19 @@ void app_load_all_icon_themes (struct app_t *app)
     // A theme can be spread across multiple search paths. Now that we know the
     // internal name for each theme, we look for subdirectories with this
     // internal name to know which directories a theme is spread across.
-    for (struct icon_theme_t *curr_theme = app->themes; curr_theme; curr_theme = curr_theme->next) {
+    for (struct icon_theme_t *curr_theme = app->loader.list; curr_theme; curr_theme = curr_theme->next) {
         char *found_dirs[num_paths];
         uint32_t num_found = 0;
         int j;
         for (j=0; j<num_paths; j++) {
-            char *curr_search_path = path[j];
-            string_t path_str = str_new (curr_search_path);
-            if (str_last(&path_str) != '/') {
-                str_cat_c (&path_str, "/");
-            }
-            str_cat_c (&path_str, curr_theme->dir_name);
-
+            struct path_builder_t path_str;
             struct stat st;
-            if (stat(str_data(&path_str), &st) == 0 && S_ISDIR(st.st_mode)) {
-                found_dirs[num_found] = pom_strdup (&curr_theme->pool, str_data(&path_str));
+            if (path_builder_set (&path_str, path[j]) &&
+                path_builder_push (&path_str, curr_theme->dir_name) &&
+                stat(path_str.str, &st) == 0 && S_ISDIR(st.st_mode)) {
+                found_dirs[num_found] = pom_strndup (&curr_theme->pool, path_str.str, path_str.len);
                 num_found++;
             }
-            str_free (&path_str);
         }
 
         curr_theme->dirs = (char**)pom_push_size (&curr_theme->pool, sizeof(char*)*num_found);
@@ -555,294 +1553,889 @@ void app_load_all_icon_themes (struct app_t *app)
         curr_theme->num_dirs = num_found;
     }
 
-    icon_theme_sort (&app->themes, -1);
+    icon_theme_sort (&app->loader.list, -1);
 
     // Unthemed icons are found inside search path directories but not in a
     // directory. For these icons we add a zero initialized theme, and set as
     // dirs all search paths with icons in them.
     //
     // NOTE: Search paths are not explored recursiveley for icons.
-    struct icon_theme_t *no_theme = app_icon_theme_new (app);
+    struct icon_theme_t *no_theme = icon_theme_new (&app->loader.list);
     no_theme->name = "None";
 
     char *found_dirs[num_paths];
     uint32_t num_found = 0;
     for (i=0; i<num_paths; i++) {
-        string_t path_str = str_new (path[i]);
-        if (str_last(&path_str) != '/') {
-            str_cat_c (&path_str, "/");
+        DIR *d = opendir (path[i]);
+        if (d == NULL) {
+            // NOTE: Current search paths may contain non existent directories.
+            //printf ("Search path does not exist.\n");
+            continue;
+        }
+
+        struct dirent *entry_info;
+        while (read_dir (d, &entry_info)) {
+            if (fname_has_valid_extension (entry_info->d_name, NULL) &&
+                dir_entry_is_reg (dirfd(d), entry_info)) {
+                uint32_t res_len = strlen (path[i]) + 1;
+                found_dirs[num_found] = (char*)pom_push_size (&no_theme->pool, res_len);
+                memcpy (found_dirs[num_found], path[i], res_len);
+                num_found++;
+                break;
+            }
+        }
+        closedir (d);
+    }
+
+    no_theme->dirs = (char**)pom_push_size (&no_theme->pool, sizeof(char*)*num_found);
+    memcpy (no_theme->dirs, found_dirs, sizeof(char*)*num_found);
+    no_theme->num_dirs = num_found;
+
+    for (struct icon_theme_t *curr_theme = app->loader.list; curr_theme; curr_theme = curr_theme->next) {
+        curr_theme->index_record = startup_index_find_theme (&app->startup_index, curr_theme);
+    }
+}
+
+// Runs in the loader thread. Finds all themes, then loads their icon names in
+// parallel, from the startup index if they didn't change. Themes are pushed
+// into the ready queue as they finish.
+void app_load_all_icon_themes_run (struct app_t *app)
+{
+    struct theme_loader_t *loader = &app->loader;
+    char **path = loader->path;
+    int num_paths = loader->num_paths;
+
+    // If no search path and no index.theme file changed since the last run,
+    // the startup index has all themes. Records are stored in the same order
+    // as the themes list, so they are created backwards.
+    bool index_is_valid = false;
+    if (startup_index_map (&app->startup_index)) {
+        index_is_valid = startup_index_themes_are_valid (&app->startup_index, path, num_paths);
+    }
+
+    if (index_is_valid) {
+        for (int i=app->startup_index.header->num_themes-1; i>=0; i--) {
+            struct icon_theme_t *theme = icon_theme_new (&loader->list);
+            startup_index_theme_init (&app->startup_index, &app->startup_index.themes[i], theme);
+            icon_theme_parse_index_file (theme);
+        }
+
+    } else {
+        app_find_icon_themes (app, path, num_paths);
+    }
+
+    int num_themes = 0;
+    for (struct icon_theme_t *curr_theme = loader->list; curr_theme; curr_theme = curr_theme->next) {
+        num_themes++;
+    }
+
+    // From now on the next pointer of themes belongs to the main thread.
+    loader->themes = malloc (MAX(num_themes, 1)*sizeof(struct icon_theme_t*));
+    struct icon_theme_t *curr_theme = loader->list;
+    for (int i=0; i<num_themes; i++) {
+        struct icon_theme_t *next = curr_theme->next;
+        curr_theme->order = i;
+        curr_theme->next = NULL;
+        loader->themes[i] = curr_theme;
+        curr_theme = next;
+    }
+    loader->list = NULL;
+    loader->num_themes = num_themes;
+    g_atomic_int_set (&loader->num_found, num_themes);
+
+    // Find all icon names for each found theme and store them in the icon_names
+    // hash table. Themes that didn't change are loaded from the startup index.
+    app_scan_themes_parallel (app);
+
+    bool needs_write = !index_is_valid;
+    for (int i=0; i<num_themes; i++) {
+        needs_write = needs_write || loader->themes[i]->scanned;
+    }
+
+    if (needs_write && !g_atomic_int_get (&loader->is_cancelled)) {
+        startup_index_write (&app->atoms, loader->themes, num_themes, path, num_paths);
+    }
+
+    g_atomic_int_set (&loader->is_done, 1);
+    app_notify_ready_themes (app);
+}
+
+gpointer app_load_all_icon_themes_thread (gpointer data)
+{
+    app_load_all_icon_themes_run ((struct app_t*)data);
+    return NULL;
+}
+
+void app_theme_loader_init (struct app_t *app)
+{
+    struct theme_loader_t *loader = &app->loader;
+    *loader = ZERO_INIT (struct theme_loader_t);
+
+    // NOTE: GtkIconTheme is not thread safe, get the search path here.
+    GtkIconTheme *icon_theme = gtk_icon_theme_get_default ();
+    gtk_icon_theme_get_search_path (icon_theme, &loader->path, &loader->num_paths);
+    loader->ready = g_async_queue_new ();
+
+    atom_table_init (&app->atoms);
+}
+
+// Main thread side of the loader. Adds a theme that finished loading to
+// app->themes.
+void app_add_ready_theme (struct app_t *app, struct icon_theme_t *theme)
+{
+    struct icon_theme_t **pos = &app->themes;
+    while (*pos != NULL && (*pos)->order < theme->order) {
+        pos = &(*pos)->next;
+    }
+    theme->next = *pos;
+    *pos = theme;
+
+    if (app->icon_name_themes.words_per_name == 0) {
+        // The number of themes is known once the first one is ready.
+        icon_name_themes_init (&app->icon_name_themes, app->loader.num_themes);
+    }
+    icon_name_themes_add (&app->icon_name_themes, theme);
+
+    app->loader.num_ready++;
+}
+
+struct icon_names_run_t {
+    atom_t *names;
+    uint32_t len;
+    uint32_t pos;
+};
+
+static inline
+bool icon_names_run_lt (struct atom_table_t *atoms, struct icon_names_run_t *a, struct icon_names_run_t *b)
+{
+    return atom_sort_key_cmp (atoms, a->names[a->pos], b->names[b->pos]) < 0;
+}
+
+// Merges the sorted names of themes into app->all_icon_names, with a k-way
+// merge where the current All list is one more sorted run. Runs are kept in a
+// binary min-heap by their current name. The same name always has the same
+// atom, so duplicates come out one after the other and are skipped.
+void app_merge_all_icon_names (struct app_t *app, struct icon_theme_t **themes, int num_themes)
+{
+    struct atom_table_t *atoms = &app->atoms;
+    mem_pool_t pool = {0};
+
+    struct icon_names_run_t *runs =
+        mem_pool_push_array (&pool, num_themes + 1, struct icon_names_run_t);
+    int num_runs = 0;
+    uint32_t max_len = 0;
+    for (int i=-1; i<num_themes; i++) {
+        struct icon_names_run_t run = {0};
+        if (i == -1) {
+            run.names = app->all_icon_names;
+            run.len = app->num_all_icon_names;
+        } else {
+            run.names = themes[i]->sorted_icon_names;
+            run.len = themes[i]->num_icon_names;
+        }
+
+        if (run.len > 0) {
+            runs[num_runs++] = run;
+            max_len += run.len;
+        }
+    }
+
+    struct icon_names_run_t **heap =
+        mem_pool_push_array (&pool, num_runs, struct icon_names_run_t*);
+    int heap_len = 0;
+    for (int i=0; i<num_runs; i++) {
+        // Sift up
+        int j = heap_len++;
+        while (j > 0 && icon_names_run_lt (atoms, &runs[i], heap[(j-1)/2])) {
+            heap[j] = heap[(j-1)/2];
+            j = (j-1)/2;
+        }
+        heap[j] = &runs[i];
+    }
+
+    atom_t *merged = malloc (MAX(max_len, 1)*sizeof(atom_t));
+    uint32_t num_merged = 0;
+    while (heap_len > 0) {
+        struct icon_names_run_t *run = heap[0];
+        atom_t atom = run->names[run->pos++];
+        if (num_merged == 0 || merged[num_merged-1] != atom) {
+            merged[num_merged++] = atom;
+        }
+
+        if (run->pos == run->len) {
+            run = heap[--heap_len];
+            if (heap_len == 0) break;
+        }
+
+        // Sift down
+        int j = 0;
+        while (2*j+1 < heap_len) {
+            int child = 2*j+1;
+            if (child+1 < heap_len && icon_names_run_lt (atoms, heap[child+1], heap[child])) {
+                child++;
+            }
+            if (!icon_names_run_lt (atoms, heap[child], run)) break;
+            heap[j] = heap[child];
+            j = child;
+        }
+        heap[j] = run;
+    }
+
+    free (app->all_icon_names);
+    app->all_icon_names = merged;
+    app->num_all_icon_names = num_merged;
+    mem_pool_destroy (&pool);
+}
+
+// Adds all themes in the ready queue. Returns true if any was added.
+bool app_merge_ready_themes (struct app_t *app)
+{
+    cont_buff_t themes = {0};
+    struct icon_theme_t *theme;
+    while ((theme = g_async_queue_try_pop (app->loader.ready)) != NULL) {
+        app_add_ready_theme (app, theme);
+        *(struct icon_theme_t**)cont_buff_push (&themes, sizeof(struct icon_theme_t*)) = theme;
+    }
+
+    int num_themes = themes.used/sizeof(struct icon_theme_t*);
+    if (num_themes > 0) {
+        app_merge_all_icon_names (app, (struct icon_theme_t**)themes.data, num_themes);
+    }
+
+    cont_buff_destroy (&themes);
+    return num_themes > 0;
+}
+
+void app_update_loaded_themes_ui (struct app_t *app);
+gboolean app_merge_ready_themes_idle (gpointer user_data)
+{
+    struct app_t *app = (struct app_t*)user_data;
+    struct theme_loader_t *loader = &app->loader;
+
+    // Cleared before popping, a theme pushed after this schedules another
+    // batch if this one doesn't get it.
+    g_atomic_int_set (&loader->is_idle_pending, 0);
+
+    bool is_done = g_atomic_int_get (&loader->is_done);
+    if (app_merge_ready_themes (app) || (is_done && !loader->is_done_shown)) {
+        app_update_loaded_themes_ui (app);
+        loader->is_done_shown = is_done;
+    }
+    return FALSE;
+}
+
+// Loads all themes without showing anything, returns when they are all in
+// app->themes.
+void app_load_all_icon_themes (struct app_t *app)
+{
+    app_theme_loader_init (app);
+    app_load_all_icon_themes_run (app);
+    app_merge_ready_themes (app);
+}
+
+// Starts loading all themes in the loader thread, they are added to the UI
+// as they finish.
+void app_load_all_icon_themes_start (struct app_t *app)
+{
+    app_theme_loader_init (app);
+    app->loader.notify_main_loop = true;
+    app->loader.thread = g_thread_new ("theme-loader", app_load_all_icon_themes_thread, app);
+}
+
+void icon_prefetch_destroy (struct icon_prefetch_t *prefetch)
+{
+    if (prefetch->idle_id != 0) {
+        g_source_remove (prefetch->idle_id);
+    }
+    mem_pool_destroy (&prefetch->pool);
+    icon_image_store_destroy (&prefetch->store);
+    *prefetch = ZERO_INIT (struct icon_prefetch_t);
+}
+
+void app_destroy (struct app_t *app)
+{
+    // Wait for the loader, themes that are still being scanned are skipped.
+    struct theme_loader_t *loader = &app->loader;
+    if (loader->thread != NULL) {
+        g_atomic_int_set (&loader->is_cancelled, 1);
+        g_thread_join (loader->thread);
+    }
+
+    for (int i=0; i<loader->num_themes; i++) {
+        icon_theme_destroy (loader->themes[i]);
+    }
+    free (loader->themes);
+    if (loader->ready != NULL) {
+        g_async_queue_unref (loader->ready);
+    }
+    g_strfreev (loader->path);
+
+    // The decoder adds to the cache when it drains its queue, destroy it
+    // first.
+    icon_prefetch_destroy (&app->prefetch);
+    image_decoder_destroy (&app->image_decoder);
+    image_cache_destroy (&app->image_cache);
+    mem_pool_destroy(&app->icon_view_pool);
+    icon_image_store_destroy (&app->icon_view_store);
+    free (app->all_icon_names);
+    icon_name_themes_destroy (&app->icon_name_themes);
+    atom_table_destroy (&app->atoms);
+
+    if (app->dir_listings != NULL) {
+        g_hash_table_destroy (app->dir_listings);
+    }
+
+    startup_index_unmap (&app->startup_index);
+}
+
+// Drops the page, dentry and inode caches so the next scan reads from disk.
+// Only works when running as root.
+bool drop_file_system_caches (void)
+{
+    sync ();
+    int fd = open ("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd == -1) return false;
+
+    bool success = write (fd, "3", 1) == 1;
+    close (fd);
+    return success;
+}
+
+float app_scan_benchmark_run (struct app_t *app, enum dir_reader_backend_t backend)
+{
+    struct timespec start, end;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (struct icon_theme_t *theme = app->themes; theme; theme = theme->next) {
+        set_theme_icon_names_full (theme, backend, false);
+
+        // Themes already have their icon names, drop the scanned ones.
+        g_hash_table_destroy (theme->scan_icon_names);
+        theme->scan_icon_names = NULL;
+        mem_pool_reset (theme->scan_pool);
+        theme->scan_pool = NULL;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    return time_elapsed_in_ms (&start, &end);
+}
+
+// Compares the time it takes to walk the directories of all themes with each
+// directory reader backend. Caches are ignored so all directories are read.
+// The cold scan is only meaningful if file system caches could be dropped.
+void app_scan_benchmark (struct app_t *app)
+{
+    struct {
+        const char *name;
+        enum dir_reader_backend_t backend;
+    } backends[] = {
+        {"readdir", DIR_READER_READDIR},
+        {"getdents", DIR_READER_GETDENTS}
+    };
+
+    int num_warm_runs = 5;
+    for (int i=0; i<ARRAY_SIZE(backends); i++) {
+        float cold = -1;
+        if (drop_file_system_caches ()) {
+            cold = app_scan_benchmark_run (app, backends[i].backend);
         }
-        uint32_t path_len = str_len (&path_str);
 
-        struct stat st;
-        if (stat(str_data(&path_str), &st) == -1 && errno == ENOENT) {
-            // NOTE: Current search paths may contain non existent directories.
-            //printf ("Search path does not exist.\n");
-            continue;
-        }
+        float warm = INFINITY;
+        for (int j=0; j<num_warm_runs; j++) {
+            warm = MIN (warm, app_scan_benchmark_run (app, backends[i].backend));
+        }
+
+        if (cold >= 0) {
+            printf ("%-8s cold: %.2f ms, warm: %.2f ms\n", backends[i].name, cold, warm);
+        } else {
+            printf ("%-8s cold: (can't drop caches, needs root), warm: %.2f ms\n", backends[i].name, warm);
+        }
+    }
+}
+
+enum map_benchmark_kind_t {
+    MAP_BENCHMARK_STR_HASH,
+    MAP_BENCHMARK_DIRECT_HASH,
+    MAP_BENCHMARK_ATOM_MAP
+};
+
+// Builds a map of the given kind with the icon names of each loaded theme,
+// then looks up every name of the All theme in all of them, like drawing the
+// theme selector of the icon view does. Returns the number of names found.
+uint32_t app_map_benchmark_run (struct app_t *app, enum map_benchmark_kind_t kind,
+                                float *build_ms, float *lookup_ms)
+{
+    struct icon_theme_t **themes = app->loader.themes;
+    int num_themes = app->loader.num_themes;
+
+    mem_pool_t pool = {0};
+    GHashTable **tables = mem_pool_push_array (&pool, num_themes, GHashTable*);
+    struct atom_map_t *maps = mem_pool_push_array (&pool, num_themes, struct atom_map_t);
+
+    struct timespec start, end;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (int i=0; i<num_themes; i++) {
+        struct icon_theme_t *theme = themes[i];
+        if (kind == MAP_BENCHMARK_STR_HASH) {
+            tables[i] = g_hash_table_new (g_str_hash, g_str_equal);
+        } else if (kind == MAP_BENCHMARK_DIRECT_HASH) {
+            tables[i] = g_hash_table_new (g_direct_hash, g_direct_equal);
+        } else {
+            atom_map_init (&pool, &maps[i], theme->num_icon_names);
+        }
+
+        for (uint32_t j=0; j<theme->num_icon_names; j++) {
+            atom_t atom = theme->sorted_icon_names[j];
+            if (kind == MAP_BENCHMARK_STR_HASH) {
+                g_hash_table_insert (tables[i], (char*)atom_str (&app->atoms, atom), theme);
+            } else if (kind == MAP_BENCHMARK_DIRECT_HASH) {
+                g_hash_table_insert (tables[i], GUINT_TO_POINTER (atom), theme);
+            } else {
+                atom_map_insert (&maps[i], atom, theme);
+            }
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    *build_ms = time_elapsed_in_ms (&start, &end);
+
+    uint32_t num_found = 0;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (uint32_t j=0; j<app->num_all_icon_names; j++) {
+        atom_t atom = app->all_icon_names[j];
+        const char *name = atom_str (&app->atoms, atom);
+        for (int i=0; i<num_themes; i++) {
+            void *value;
+            if (kind == MAP_BENCHMARK_STR_HASH) {
+                value = g_hash_table_lookup (tables[i], name);
+            } else if (kind == MAP_BENCHMARK_DIRECT_HASH) {
+                value = g_hash_table_lookup (tables[i], GUINT_TO_POINTER (atom));
+            } else {
+                value = atom_map_lookup (&maps[i], atom);
+            }
+            num_found += value != NULL;
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    *lookup_ms = time_elapsed_in_ms (&start, &end);
+
+    if (kind != MAP_BENCHMARK_ATOM_MAP) {
+        for (int i=0; i<num_themes; i++) {
+            g_hash_table_destroy (tables[i]);
+        }
+    }
+    mem_pool_destroy (&pool);
+    return num_found;
+}
+
+// Compares atom_map_t, which themes use to map icon names to their locations,
+// against GHashTable keyed by atom strings (what themes used before names
+// were interned) and by atoms.
+void app_map_benchmark (struct app_t *app)
+{
+    struct {
+        const char *name;
+        enum map_benchmark_kind_t kind;
+    } kinds[] = {
+        {"GHashTable (strings)", MAP_BENCHMARK_STR_HASH},
+        {"GHashTable (atoms)", MAP_BENCHMARK_DIRECT_HASH},
+        {"atom_map_t", MAP_BENCHMARK_ATOM_MAP}
+    };
+
+    uint32_t num_lookups = app->num_all_icon_names*app->loader.num_themes;
+    printf ("%d themes, %u icon names, %u lookups\n",
+            app->loader.num_themes, app->num_all_icon_names, num_lookups);
+
+    int num_runs = 5;
+    for (int i=0; i<ARRAY_SIZE(kinds); i++) {
+        float build = INFINITY, lookup = INFINITY;
+        uint32_t num_found = 0;
+        for (int j=0; j<num_runs; j++) {
+            float run_build, run_lookup;
+            num_found = app_map_benchmark_run (app, kinds[i].kind, &run_build, &run_lookup);
+            build = MIN (build, run_build);
+            lookup = MIN (lookup, run_lookup);
+        }
+
+        printf ("%-20s build: %.2f ms, lookup: %.2f ms (%.1f ns each), found: %u\n",
+                kinds[i].name, build, lookup,
+                num_lookups > 0 ? lookup*1e6/num_lookups : 0, num_found);
+    }
+}
+
+// Appends the paths of all images of all themes to paths, as offsets into
+// strings. Returns the number of paths.
+uint32_t app_collect_image_paths (struct app_t *app, cont_buff_t *strings, cont_buff_t *paths)
+{
+    uint32_t num_paths = 0;
+    for (struct icon_theme_t *theme = app->themes; theme; theme = theme->next) {
+        for (uint32_t i=0; i<theme->num_icon_names; i++) {
+            atom_t atom = theme->sorted_icon_names[i];
+            const char *icon_name = atom_str (&app->atoms, atom);
+            struct icon_location_t *l = atom_map_lookup (&theme->icon_names, atom);
+            for (; l != NULL; l = l->next) {
+                struct path_builder_t path;
+                if (!path_builder_set (&path, theme->dirs[l->dir]) ||
+                    (l->section != ICON_LOCATION_NO_SECTION &&
+                     !path_builder_push_n (&path, theme->sections[l->section].name,
+                                           theme->sections[l->section].name_len)) ||
+                    !path_builder_push (&path, icon_name) ||
+                    path.len + strlen (app->valid_extensions[l->ext]) >= ARRAY_SIZE(path.str)) {
+                    continue;
+                }
+                strcat (path.str, app->valid_extensions[l->ext]);
+
+                *(uint32_t*)cont_buff_push (paths, sizeof(uint32_t)) = strings->used;
+                strcpy (cont_buff_push (strings, strlen (path.str) + 1), path.str);
+                num_paths++;
+            }
+        }
+    }
+    return num_paths;
+}
+
+void app_probe_benchmark (struct app_t *app)
+{
+    cont_buff_t strings = {0};
+    cont_buff_t paths_buff = {0};
+    uint32_t num_paths = app_collect_image_paths (app, &strings, &paths_buff);
+    uint32_t *paths = (uint32_t*)paths_buff.data;
+    int *sizes = malloc (MAX(num_paths, 1)*2*sizeof(int));
+
+    struct timespec start, end;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    uint32_t num_probed = 0;
+    for (uint32_t i=0; i<num_paths; i++) {
+        struct stat st;
+        int *size = &sizes[2*i];
+        if (image_probe ((char*)strings.data + paths[i], &st, &size[0], &size[1]) && size[0] > 0) {
+            num_probed++;
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    float probe_time = time_elapsed_in_ms (&start, &end);
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    uint32_t num_decoded = 0, num_mismatches = 0;
+    for (uint32_t i=0; i<num_paths; i++) {
+        GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file ((char*)strings.data + paths[i], NULL);
+        if (pixbuf != NULL) {
+            num_decoded++;
+            int *size = &sizes[2*i];
+            if (size[0] > 0 &&
+                (size[0] != gdk_pixbuf_get_width (pixbuf) || size[1] != gdk_pixbuf_get_height (pixbuf))) {
+                num_mismatches++;
+            }
+            g_object_unref (pixbuf);
+        }
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+    float decode_time = time_elapsed_in_ms (&start, &end);
+
+    printf ("%u images\n", num_paths);
+    printf ("probe:  %.2f ms (%.1f us each), sized: %u\n",
+            probe_time, num_paths > 0 ? probe_time*1e3/num_paths : 0, num_probed);
+    printf ("decode: %.2f ms (%.1f us each), decoded: %u, size mismatches: %u\n",
+            decode_time, num_paths > 0 ? decode_time*1e3/num_paths : 0, num_decoded, num_mismatches);
+
+    free (sizes);
+    cont_buff_destroy (&paths_buff);
+    cont_buff_destroy (&strings);
+}
+
+// Pool self test. Several producer threads allocate in their thread local
+// pool and in a pool of their own, registering an on destroy callback for
+// each allocation. The thread local pool is adopted by the producer's pool,
+// which is then adopted by a parent pool in the main thread. Destroying the
+// parent must run each callback exactly once, after the producers exited.
+#define POOL_SELFTEST_PRODUCERS 8
+#define POOL_SELFTEST_ALLOCATIONS 4000
+
+struct pool_selftest_job_t {
+    int id;
+    GAsyncQueue *done;
+    mem_pool_t pool;
+
+    gint *destroy_counts;
+    uint32_t **allocations;
+};
+
+// Some allocations are larger than the biggest growth bin, so they get a bin
+// of their own.
+static inline
+uint32_t pool_selftest_len (int i)
+{
+    return i%1000 == 999 ? MEM_POOL_MAX_GROWTH_BIN_SIZE : 4 + (i*37)%1024;
+}
+
+ON_DESTROY_CALLBACK (pool_selftest_destroy)
+{
+    g_atomic_int_inc ((gint*)clsr);
+}
+
+gpointer pool_selftest_producer (gpointer data)
+{
+    struct pool_selftest_job_t *job = data;
+    mem_pool_t *thread_pool = mem_pool_thread_local ();
+    // Mix malloc'd and mmap'd bins.
+    job->pool.use_huge_pages = job->id%2 == 1;
+
+    for (int i=0; i<POOL_SELFTEST_ALLOCATIONS; i++) {
+        int idx = job->id*POOL_SELFTEST_ALLOCATIONS + i;
+        mem_pool_t *pool = i%2 == 0 ? thread_pool : &job->pool;
+
+        uint32_t len = pool_selftest_len (i);
+        uint32_t *allocation = mem_pool_push_size_full (pool, len*sizeof(uint32_t), POOL_UNINITIALIZED,
+                                                        pool_selftest_destroy, &job->destroy_counts[idx]);
+        allocation[0] = idx;
+        allocation[len-1] = idx;
+        job->allocations[idx] = allocation;
+    }
+
+    mem_pool_adopt (&job->pool, thread_pool);
+    g_async_queue_push (job->done, job);
+    return NULL;
+}
+
+bool pool_selftest_run (void)
+{
+    bool success = true;
+    int num_allocations = POOL_SELFTEST_PRODUCERS*POOL_SELFTEST_ALLOCATIONS;
+    gint *destroy_counts = calloc (num_allocations, sizeof(gint));
+    uint32_t **allocations = calloc (num_allocations, sizeof(uint32_t*));
+    GAsyncQueue *done = g_async_queue_new ();
+
+    struct pool_selftest_job_t jobs[POOL_SELFTEST_PRODUCERS];
+    GThread *threads[POOL_SELFTEST_PRODUCERS];
+    for (int i=0; i<POOL_SELFTEST_PRODUCERS; i++) {
+        jobs[i] = ZERO_INIT (struct pool_selftest_job_t);
+        jobs[i].id = i;
+        jobs[i].done = done;
+        jobs[i].destroy_counts = destroy_counts;
+        jobs[i].allocations = allocations;
+        threads[i] = g_thread_new ("pool-selftest", pool_selftest_producer, &jobs[i]);
+    }
 
-        DIR *d = opendir (str_data(&path_str));
-        struct dirent *entry_info;
-        while (read_dir (d, &entry_info)) {
-            str_put_c (&path_str, path_len, entry_info->d_name);
-
-            if (stat(str_data(&path_str), &st) == 0 && S_ISREG(st.st_mode)) {
-                if (fname_has_valid_extension (entry_info->d_name, NULL)) {
-                    uint32_t res_len = strlen (path[i]) + 1;
-                    found_dirs[num_found] = (char*)pom_push_size (&no_theme->pool, res_len);
-                    memcpy (found_dirs[num_found], path[i], res_len);
-                    num_found++;
-                    break;
-                }
-            }
-        }
-        str_free (&path_str);
-        closedir (d);
+    mem_pool_t parent = {0};
+    for (int i=0; i<POOL_SELFTEST_PRODUCERS; i++) {
+        struct pool_selftest_job_t *job = g_async_queue_pop (done);
+        mem_pool_adopt (&parent, &job->pool);
     }
 
-    no_theme->dirs = (char**)pom_push_size (&no_theme->pool, sizeof(char*)*num_found);
-    memcpy (no_theme->dirs, found_dirs, sizeof(char*)*num_found);
-    no_theme->num_dirs = num_found;
+    // Producers destroy their thread local pool when they exit, nothing they
+    // allocated must be freed by that.
+    for (int i=0; i<POOL_SELFTEST_PRODUCERS; i++) {
+        g_thread_join (threads[i]);
+    }
 
-    // Find all icon names for each found theme and store them in the icon_names
-    // hash table.
-    for (struct icon_theme_t *curr_theme = app->themes; curr_theme; curr_theme = curr_theme->next) {
-        set_theme_icon_names (curr_theme);
-    }
-
-    // Add all icon themes into a structure so we can fake an "All" theme.
-    app->all_icon_names_pool = ZERO_INIT (mem_pool_t);
-    app->all_icon_names = g_tree_new (str_cmp_callback);
-
-    struct icon_theme_t *curr_theme = app->themes;
-    for (; curr_theme; curr_theme = curr_theme->next) {
-        GList *icon_names = g_hash_table_get_keys (curr_theme->icon_names);
-        for (GList *l = icon_names; l != NULL; l = l->next) {
-            if (!g_tree_lookup_extended (app->all_icon_names, l->data, NULL, NULL)) {
-                char *icon_name = pom_strdup (&app->all_icon_names_pool, l->data);
-                g_tree_insert (app->all_icon_names, icon_name, NULL);
-            }
+    int num_freed_early = 0, num_corrupt = 0;
+    for (int i=0; i<num_allocations; i++) {
+        if (g_atomic_int_get (&destroy_counts[i]) != 0) {
+            num_freed_early++;
+        }
+        uint32_t len = pool_selftest_len (i%POOL_SELFTEST_ALLOCATIONS);
+        if (allocations[i] == NULL || allocations[i][0] != (uint32_t)i || allocations[i][len-1] != (uint32_t)i) {
+            num_corrupt++;
         }
-        g_list_free (icon_names);
     }
-}
 
-void app_destroy (struct app_t *app)
-{
-    struct icon_theme_t *curr_theme = app->themes;
-    while (curr_theme != NULL) {
-        struct icon_theme_t *to_destroy = curr_theme;
-        curr_theme = curr_theme->next;
+    mem_pool_destroy (&parent);
 
-        icon_theme_destroy (to_destroy);
+    int num_not_once = 0;
+    for (int i=0; i<num_allocations; i++) {
+        if (g_atomic_int_get (&destroy_counts[i]) != 1) {
+            num_not_once++;
+        }
     }
 
-    mem_pool_destroy(&app->icon_view_pool);
-    free (app->selected_icon);
+    printf ("%d producers, %d allocations\n", POOL_SELFTEST_PRODUCERS, num_allocations);
+    if (num_freed_early > 0) {
+        printf ("FAIL: %d allocations freed before destroying the parent pool.\n", num_freed_early);
+        success = false;
+    }
+    if (num_corrupt > 0) {
+        printf ("FAIL: %d allocations changed after adoption.\n", num_corrupt);
+        success = false;
+    }
+    if (num_not_once > 0) {
+        printf ("FAIL: %d on destroy callbacks didn't run exactly once.\n", num_not_once);
+        success = false;
+    }
+    if (success) {
+        printf ("OK\n");
+    }
 
-    mem_pool_destroy(&app->all_icon_names_pool);
-    g_tree_destroy (app->all_icon_names);
+    g_async_queue_unref (done);
+    free (allocations);
+    free (destroy_counts);
+    return success;
 }
 
 // This makes scalable images always sort as the largest.
-bool is_img_lt (struct icon_image_t *a, struct icon_image_t *b)
+static inline
+bool is_img_lt (struct icon_image_store_t *store, uint32_t a, uint32_t b)
 {
-    if (a->is_scalable == b->is_scalable) {
-        return a->size < b->size;
+    if (store->is_scalable[a] == store->is_scalable[b]) {
+        return store->size[a] < store->size[b];
     } else {
-        return b->is_scalable;
+        return store->is_scalable[b];
     }
 }
 
-templ_sort_ll(icon_image_sort, struct icon_image_t, is_img_lt(a, b))
+templ_sort (icon_image_sort, uint32_t, is_img_lt (user_data, *a, *b))
 
 // Some of the information in the icon view is derived from the base information
 // taken from the icon database (or faked for the folder theme or the unthemed
 // theme). This fuction computes that.
 void icon_view_compute_derived_data (mem_pool_t *pool, struct icon_view_t *icon_view)
 {
+    struct icon_image_store_t *store = icon_view->store;
+    int max_images_len = 0;
     for (int i=0; i<ARRAY_SIZE(icon_view->images); i++) {
-        struct icon_image_t *img = icon_view->images[i];
-
-        while (img != NULL) {
+        icon_view->images_len[i] = 0;
+        for (uint32_t id = icon_view->images_first[i]; id != ICON_IMAGE_NONE; id = store->next[id]) {
             icon_view->images_len[i]++;
+        }
+        icon_view->images[i] = mem_pool_push_array (pool, icon_view->images_len[i], uint32_t);
 
-            // Compute label for the image
-            // NOTE: If it's the theme that contains unthemed icons. Leave the
-            // label as NULL.
-            img->label = NULL;
-            if (img->is_scalable) {
-                img->label = pprintf (pool, "Scalable");
-            } else if (img->size > 0) {
-                img->label = pprintf (pool, "%d", img->size);
-            }
+        int j = 0;
+        for (uint32_t id = icon_view->images_first[i]; id != ICON_IMAGE_NONE; id = store->next[id]) {
+            icon_view->images[i][j++] = id;
+
+            struct icon_image_ui_t *img = &store->ui[id];
+            char *full_path = icon_image_full_path (store, id);
 
             // Set back pointer into icon_view_t
             img->view = icon_view;
 
-            // Create a GtkImage for the found image
-            img->image = gtk_image_new_from_file (img->full_path);
+            // The image is decoded by app.image_decoder when the icon view is
+            // shown. Until then the icon strip lays it out with the size read
+            // from the file's header.
             struct stat st;
-            stat(img->full_path, &st);
-            img->file_size = st.st_size;
-            gtk_widget_set_valign (img->image, GTK_ALIGN_END);
-
-            // Find the size of the created image
-            GdkPixbuf *pixbuf = gtk_image_get_pixbuf (GTK_IMAGE(img->image));
-            if (pixbuf) {
-                img->width = gdk_pixbuf_get_width(pixbuf);
-                img->height = gdk_pixbuf_get_height(pixbuf);
+            int width, height;
+            if (image_probe (full_path, &st, &width, &height)) {
+                store->file_size[id] = st.st_size;
+                store->width[id] = MIN (width, UINT16_MAX);
+                store->height[id] = MIN (height, UINT16_MAX);
+                image_cache_key_from_stat (&st, store->scale[id], &store->cache_key[id]);
             }
-            gtk_widget_set_size_request (img->image, img->width, img->height);
-
-            g_assert (img->image != NULL);
-            // The container to which images will be parented will get destroyed
-            // when changing icon scales, we need to take a reference here so we
-            // can go back to them. The lifespan of these images should be equal
-            // to icon_view_t, not to their parent container.
-            // @scale_change_destroys_images
-            g_object_ref_sink (G_OBJECT(img->image));
-
-            img = img->next;
         }
 
-        // Sort the image linked list based on their size
+        // Sort images based on their size
         if (icon_view->images_len[i] > 1) {
-            // TODO: Sorted linked lists seem to be the common case we
-            // can detect if sorting is required before and only sort if
-            // necessary.
-            // @performance
-            icon_image_sort (&icon_view->images[i], icon_view->images_len[i]);
+            icon_image_sort_user_data (icon_view->images[i], icon_view->images_len[i], store);
         }
+        max_images_len = MAX (max_images_len, icon_view->images_len[i]);
     }
+
+    icon_view->strip_items = mem_pool_push_array (pool, max_images_len, struct icon_strip_item_t);
 }
 
-// Add a new icon_image_t at the end of its corresponding linked list, according
-// to the scale.
-bool icon_view_push_image (struct icon_view_t *icon_view, struct icon_image_t *new_icon_image)
+void icon_view_init (struct icon_view_t *icon_view, struct icon_image_store_t *store)
 {
-    int scale = MAX (new_icon_image->scale, 1);
-    if (scale <= IV_MAX_SCALE) {
-        if (icon_view->images_end[scale-1] != NULL) {
-            icon_view->images_end[scale-1]->next = new_icon_image;
-        } else {
-            icon_view->images[scale-1] = new_icon_image;
-        }
+    *icon_view = ZERO_INIT (struct icon_view_t);
+    icon_view->store = store;
+    icon_view->scale = 1;
+    icon_view->selected_img = ICON_IMAGE_NONE;
+    icon_view->drag_img = ICON_IMAGE_NONE;
+    for (int i=0; i<IV_MAX_SCALE; i++) {
+        icon_view->images_first[i] = ICON_IMAGE_NONE;
+        icon_view->images_last[i] = ICON_IMAGE_NONE;
+    }
+}
 
-        icon_view->images_end[scale-1] = new_icon_image;
-        return true;
+// Adds a new image of the given scale to the store of icon_view, at the end of
+// the images with that scale. Returns its id, or ICON_IMAGE_NONE if the scale
+// isn't supported.
+uint32_t icon_view_push_image (struct icon_view_t *icon_view, int scale,
+                               const char *full_path, uint32_t dir_len)
+{
+    scale = MAX (scale, 1);
+    if (scale > IV_MAX_SCALE) {
+        return ICON_IMAGE_NONE;
+    }
+
+    struct icon_image_store_t *store = icon_view->store;
+    uint32_t id = icon_image_store_push (store, full_path, dir_len);
+    store->scale[id] = scale;
+
+    if (icon_view->images_last[scale-1] != ICON_IMAGE_NONE) {
+        store->next[icon_view->images_last[scale-1]] = id;
     } else {
-        return false;
+        icon_view->images_first[scale-1] = id;
     }
+    icon_view->images_last[scale-1] = id;
+    return id;
 }
 
-void icon_view_compute (mem_pool_t *pool,
-                        struct icon_theme_t *theme, const char *icon_name,
-                        struct icon_view_t *icon_view)
+// Finds the file for icon_name inside dir, which is the directory with index
+// dir_idx of theme, plus the directory of the section with index section_idx.
+// Locations recorded while scanning are used so nothing is read from disk,
+// only icons the scan didn't find fall back to reading the directory.
+bool icon_theme_image_lookup (mem_pool_t *pool, struct icon_theme_t *theme, char *dir,
+                              uint32_t dir_idx, uint32_t section_idx,
+                              const char *icon_name, char **found_file)
+{
+    struct icon_location_t *locations = icon_theme_get_locations (theme, icon_name);
+    if (locations == NULL) {
+        return icon_lookup (pool, dir, icon_name, found_file);
+    }
+
+    for (struct icon_location_t *l = locations; l != NULL; l = l->next) {
+        if (l->dir == dir_idx && l->section == section_idx) {
+            bool has_slash = *dir != '\0' && dir[strlen(dir)-1] == '/';
+            *found_file = pprintf (pool, "%s%s%s%s", dir, has_slash ? "" : "/",
+                                   icon_name, app.valid_extensions[l->ext]);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Finds the images of icon_name in theme and pushes them into store, without
+// creating any widget. Everything else is allocated in pool.
+void icon_view_lookup_images (mem_pool_t *pool, struct icon_image_store_t *store,
+                              struct icon_theme_t *theme, const char *icon_name,
+                              struct icon_view_t *icon_view)
 {
     assert (strcmp (theme->name, "All") != 0);
 
-    *icon_view = ZERO_INIT (struct icon_view_t);
-    icon_view->scale = 1;
-    icon_view->icon_name = pom_strndup (pool, icon_name, strlen(icon_name));
+    icon_view_init (icon_view, store);
+    icon_view->icon_name = (char*)icon_name; // atom string
 
     if (theme->index_file != NULL) {
         bool found_image = false;
         int i;
         for (i = 0; i < theme->num_dirs; i++) {
-            string_t path = str_new (theme->dirs[i]);
-            if (str_last (&path) != '/') {
-                str_cat_c (&path, "/");
+            struct path_builder_t path;
+            if (!path_builder_set (&path, theme->dirs[i]) || !path_builder_push (&path, "")) {
+                continue;
             }
-            uint32_t path_len = str_len (&path);
-            char *c = theme->index_file;
-
-            // Ignore the first section: [Icon Theme]
-            c = seek_next_section (c, NULL, NULL);
-            c = consume_section (c);
-
-            while (*c) {
-                // FIXME: We currently ignore the Directories key in the first
-                // section [Icon Theme], some themes (Oxygen) have repeated
-                // directory sections while they are unique in the Directories
-                // key. Icons in these folders will show several times. Maybe
-                // read the Directories key or do nothing so theme developers
-                // can notice something strange is going on.
-                char *section_name;
-                uint32_t section_name_len;
-                c = seek_next_section (c, &section_name, &section_name_len);
-                string_t dir = strn_new (section_name, section_name_len);
-                str_put (&path, path_len, &dir);
-
-                char *icon_path;
-                if (icon_lookup (pool, str_data (&path), icon_name, &icon_path)) {
-                    // TODO: Maybe get this information before looking up the directory
-                    // and conditionally call icon_lookup() depending on the information
-                    // we get.
-
-                    struct icon_image_t img = ZERO_INIT(struct icon_image_t);
-                    mem_pool_marker_t mrkr = mem_pool_begin_temporary_memory (pool);
-                    img.scale = 1;
-                    img.min_size = -1;
-                    img.max_size = -1;
-                    img.size = -1;
-                    int icon_path_len = strlen(icon_path);
-                    img.full_path = pom_strndup (pool, icon_path, icon_path_len);
-                    img.theme_dir = pom_strndup (pool, icon_path, path_len);
-                    img.path = pom_strndup (pool, icon_path + path_len, icon_path_len - path_len);
-
-                    // NOTE: We say an image is scalable if dir contains the
-                    // substring "scalable" as this is what developers seem to
-                    // use. The index file may disagree, and Gtk for example
-                    // makes any .svg icon 'scalable' no matter what the index
-                    // file or dir says.
-                    img.is_scalable = strstr (str_data(&dir), "scalable") != NULL ? true : false;
-
-                    while ((c = consume_ignored_lines (c)) && !is_end_of_section(c)) {
-                        char *key, *value;
-                        uint32_t key_len, value_len;
-                        c = seek_next_key_value (c, &key, &key_len, &value, &value_len);
-                        if (strncmp (key, "Size", MIN(4, key_len)) == 0) {
-                            sscanf (value, "%"SCNi32, &img.size);
-
-                        } else if (strncmp (key, "MinSize", MIN(7, key_len)) == 0) {
-                            sscanf (value, "%"SCNi32, &img.min_size);
-
-                        } else if (strncmp (key, "MaxSize", MIN(7, key_len)) == 0) {
-                            sscanf (value, "%"SCNi32, &img.max_size);
-
-                        } else if (strncmp (key, "Scale", MIN(5, key_len)) == 0) {
-                            sscanf (value, "%"SCNi32, &img.scale);
-
-                        } else if (strncmp (key, "Type", MIN(4, key_len)) == 0) {
-                            img.type = pom_strndup (pool, value, value_len);
-
-                        } else if (strncmp (key, "Context", MIN(7, key_len)) == 0) {
-                            img.context = pom_strndup (pool, value, value_len);
-                        }
-                    }
+            uint32_t path_len = path.len;
 
-                    // Create the icon_image_t structure inside pool.
-                    struct icon_image_t *new_img =
-                        mem_pool_push_size (pool, sizeof(struct icon_image_t));
-                    *new_img = img;
+            for (uint32_t j=0; j<theme->num_sections; j++) {
+                struct theme_section_t *section = &theme->sections[j];
+                path_builder_truncate (&path, path_len);
+                if (!path_builder_push_n (&path, section->name, section->name_len)) {
+                    continue;
+                }
 
-                    // Add the new image at the end of the corresponding linked list
-                    if (icon_view_push_image (icon_view, new_img)) {
+                char *icon_path;
+                if (icon_theme_image_lookup (pool, theme, path.str, i, j, icon_name, &icon_path)) {
+                    uint32_t id = icon_view_push_image (icon_view, section->scale, icon_path, path_len);
+                    if (id != ICON_IMAGE_NONE) {
+                        struct icon_image_store_t *store = icon_view->store;
+
+                        // Type and context strings are owned by the theme.
+                        store->size[id] = icon_image_size_from_index (section->size);
+                        store->min_size[id] = icon_image_size_from_index (section->min_size);
+                        store->max_size[id] = icon_image_size_from_index (section->max_size);
+                        store->type[id] = section->type;
+                        store->context[id] = section->context;
+                        store->is_scalable[id] = section->is_scalable;
                         found_image = true;
-                    } else {
-                        mem_pool_end_temporary_memory (mrkr);
                     }
-
-                } else {
-                    c = consume_section (c);
                 }
-
-                str_free (&dir);
             }
 
-            str_free (&path);
-
             // If we found something in a search path then stop looking in the
             // other ones.
             if (found_image) break;
@@ -853,66 +2446,185 @@ void icon_view_compute (mem_pool_t *pool,
     } else {
         int i;
         for (i = 0; i < theme->num_dirs; i++) {
-            string_t path = str_new (theme->dirs[i]);
-            if (str_last (&path) != '/') {
-                str_cat_c (&path, "/");
-            }
-
             char *icon_path;
-            if (icon_lookup (pool, str_data (&path), icon_name, &icon_path)) {
-                struct icon_image_t *new_img =
-                    mem_pool_push_size (pool, sizeof(struct icon_image_t));
-                *new_img = ZERO_INIT(struct icon_image_t);
-                new_img->path = pom_strndup(pool, icon_path, strlen(icon_path));
-                new_img->full_path = new_img->path;
-                new_img->scale = 1;
-
-                icon_view_push_image (icon_view, new_img);
+            if (icon_theme_image_lookup (pool, theme, theme->dirs[i], i, ICON_LOCATION_NO_SECTION,
+                                         icon_name, &icon_path)) {
+                icon_view_push_image (icon_view, 1, icon_path, 0);
             }
-
-            str_free (&path);
         }
     }
+}
 
+// Images are pushed into store, everything else is allocated in pool.
+void icon_view_compute (mem_pool_t *pool, struct icon_image_store_t *store,
+                        struct icon_theme_t *theme, const char *icon_name,
+                        struct icon_view_t *icon_view)
+{
+    icon_view_lookup_images (pool, store, theme, icon_name, icon_view);
     icon_view_compute_derived_data (pool, icon_view);
 }
 
+// NOTE: selected_icon must be an atom string.
 void app_update_selected_icon (struct app_t *app, const char *selected_icon)
 {
-    if (app->selected_icon) {
-        if (strcmp (app->selected_icon, selected_icon) != 0) {
-            free (app->selected_icon);
-            app->selected_icon = strdup (selected_icon);
+    app->selected_icon = selected_icon;
+}
+
+void app_set_icon_view (struct app_t *app, const char *icon_name)
+{
+    // Clearing the store releases the surfaces of the previous icon_view,
+    // the ones still in app.image_cache stay there.
+    icon_image_store_clear (&app->icon_view_store);
+
+    // Update data in the icon_view_t structure. The pool and the store keep
+    // their memory, so once they grew to fit the largest icon seen, browsing
+    // doesn't allocate.
+    mem_pool_reset (&app->icon_view_pool);
+    app_update_selected_icon (app, icon_name);
+    icon_view_compute (&app->icon_view_pool, &app->icon_view_store,
+                       app->selected_theme, icon_name, &app->icon_view);
+
+    replace_wrapped_widget_deferred (&app->icon_view_widget, draw_icon_view (&app->icon_view));
+}
+
+void app_prefetch_cancel (struct app_t *app)
+{
+    struct icon_prefetch_t *prefetch = &app->prefetch;
+    if (prefetch->idle_id != 0) {
+        g_source_remove (prefetch->idle_id);
+        prefetch->idle_id = 0;
+    }
+    prefetch->num_items = 0;
+    prefetch->next_item = 0;
+    image_decoder_cancel_prefetches (&app->image_decoder);
+}
+
+static inline
+bool app_prefetch_image (struct app_t *app, const char *path, struct image_cache_key_t *key)
+{
+    struct icon_prefetch_t *prefetch = &app->prefetch;
+    if (prefetch->num_images >= ICON_PREFETCH_MAX_IMAGES) {
+        return false;
+    }
+
+    if (!image_cache_contains (&app->image_cache, key)) {
+        image_decoder_prefetch (&app->image_decoder, path, key);
+        prefetch->num_images++;
+    }
+    return true;
+}
+
+void app_prefetch_item (struct app_t *app, struct icon_prefetch_item_t *item)
+{
+    struct icon_prefetch_t *prefetch = &app->prefetch;
+
+    if (item->folder_view != NULL) {
+        struct icon_view_t *view = item->folder_view;
+        struct icon_image_store_t *store = view->store;
+        for (int i=0; i<ARRAY_SIZE(view->images); i++) {
+            for (int j=0; j<view->images_len[i]; j++) {
+                uint32_t id = view->images[i][j];
+                if (!app_prefetch_image (app, icon_image_full_path (store, id), &store->cache_key[id])) {
+                    return;
+                }
+            }
         }
+
     } else {
-        app->selected_icon = strdup (selected_icon);
+        icon_image_store_clear (&prefetch->store);
+        mem_pool_reset (&prefetch->pool);
+
+        struct icon_view_t view;
+        icon_view_lookup_images (&prefetch->pool, &prefetch->store, item->theme, item->icon_name, &view);
+
+        struct icon_image_store_t *store = &prefetch->store;
+        for (uint32_t id=0; id<store->num_images; id++) {
+            const char *path = icon_image_full_path (store, id);
+            struct stat st;
+            int width, height;
+            struct image_cache_key_t key;
+            if (!image_probe (path, &st, &width, &height)) {
+                continue;
+            }
+
+            image_cache_key_from_stat (&st, store->scale[id], &key);
+            if (!app_prefetch_image (app, path, &key)) {
+                return;
+            }
+        }
     }
 }
 
-void app_set_icon_view (struct app_t *app, const char *icon_name)
+gboolean app_prefetch_idle (gpointer user_data)
 {
-    // Unref all GtkImages before creating the new icon_view. I don't like this,
-    // istead of storing a GtkImage we should store our own data structure that
-    // has things inside icon_view_pool.
-    // @scale_change_destroys_images
-    for (int i=0; i<ARRAY_SIZE(app->icon_view.images); i++) {
-        struct icon_image_t *img = app->icon_view.images[i];
+    struct app_t *app = (struct app_t*)user_data;
+    struct icon_prefetch_t *prefetch = &app->prefetch;
 
-        while (img != NULL) {
-            if (img->image != NULL) {
-                g_object_unref (G_OBJECT(img->image));
+    if (prefetch->next_item < prefetch->num_items &&
+        prefetch->num_images < ICON_PREFETCH_MAX_IMAGES) {
+        app_prefetch_item (app, &prefetch->items[prefetch->next_item++]);
+    }
+
+    if (prefetch->next_item < prefetch->num_items &&
+        prefetch->num_images < ICON_PREFETCH_MAX_IMAGES) {
+        return G_SOURCE_CONTINUE;
+    } else {
+        prefetch->idle_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+}
+
+// Theme the icon view of icon_name is computed from when it's selected in the
+// list of the current theme.
+struct icon_theme_t* app_icon_list_theme (struct app_t *app, const char *icon_name)
+{
+    if (app->selected_theme_type == THEME_TYPE_ALL) {
+        return app_first_theme_with_icon (app, icon_name);
+    } else {
+        return app->selected_theme;
+    }
+}
+
+// Moves *idx to the next visible row in the list of the current theme, in the
+// direction of dir (1 or -1), and returns the icon name it shows. Returns NULL
+// at the end of the list.
+const char* app_icon_list_step (struct app_t *app, struct fk_list_box_t *fk_list_box, int *idx, int dir);
+
+// Queues the rows around idx, a visible row of the list of the current theme,
+// to be prefetched.
+void app_prefetch_schedule (struct app_t *app, struct fk_list_box_t *fk_list_box, int idx)
+{
+    struct icon_prefetch_t *prefetch = &app->prefetch;
+    int step = idx >= prefetch->last_idx ? 1 : -1;
+    prefetch->last_idx = idx;
+
+    app_prefetch_cancel (app);
+    prefetch->num_images = 0;
+
+    // Alternate between rows ahead and behind, closest first.
+    int pos[2] = {idx, idx};
+    int dirs[2] = {step, -step};
+    for (int i=0; i<ICON_PREFETCH_ROWS; i++) {
+        for (int j=0; j<2; j++) {
+            const char *icon_name = app_icon_list_step (app, fk_list_box, &pos[j], dirs[j]);
+            if (icon_name == NULL) continue;
+
+            struct icon_prefetch_item_t *item = &prefetch->items[prefetch->num_items++];
+            *item = ZERO_INIT (struct icon_prefetch_item_t);
+            item->icon_name = icon_name;
+            if (app->selected_theme_type == THEME_TYPE_FOLDER) {
+                item->folder_view = g_tree_lookup (app->folder_theme_icon_names, icon_name);
+                if (item->folder_view == NULL) prefetch->num_items--;
+            } else {
+                item->theme = app_icon_list_theme (app, icon_name);
+                if (item->theme == NULL) prefetch->num_items--;
             }
-            img = img->next;
         }
     }
 
-    // Update data in the icon_view_t structure
-    mem_pool_destroy (&app->icon_view_pool);
-    app->icon_view_pool = ZERO_INIT(mem_pool_t);
-    app_update_selected_icon (app, icon_name);
-    icon_view_compute (&app->icon_view_pool, app->selected_theme, icon_name, &app->icon_view);
-
-    replace_wrapped_widget_deferred (&app->icon_view_widget, draw_icon_view (&app->icon_view));
+    if (prefetch->num_items > 0) {
+        prefetch->idle_id = g_idle_add_full (G_PRIORITY_LOW, app_prefetch_idle, app, NULL);
+    }
 }
 
 void on_icon_selected (GtkListBox *box, GtkListBoxRow *row, gpointer user_data)
@@ -922,9 +2634,10 @@ void on_icon_selected (GtkListBox *box, GtkListBoxRow *row, gpointer user_data)
     }
 
     GtkWidget *row_label = gtk_bin_get_child (GTK_BIN(row));
-    const char *icon_name = gtk_label_get_text (GTK_LABEL(row_label));
+    atom_t icon_name = atom_lookup (&app.atoms, gtk_label_get_text (GTK_LABEL(row_label)));
 
-    app_set_icon_view (&app, icon_name);
+    app_set_icon_view (&app, atom_str (&app.atoms, icon_name));
+    app_prefetch_schedule (&app, NULL, gtk_list_box_row_get_index (row));
 }
 
 FK_LIST_BOX_ROW_SELECTED_CB (on_all_theme_row_selected)
@@ -932,15 +2645,13 @@ FK_LIST_BOX_ROW_SELECTED_CB (on_all_theme_row_selected)
     const char *icon_name = fk_list_box->visible_rows[idx]->data;
 
     if (app.selected_theme_type == THEME_TYPE_ALL) {
-        struct icon_theme_t *theme;
-        for (theme = app.themes; theme; theme = theme->next) {
-            if (g_hash_table_contains (theme->icon_names, icon_name)) break;
-        }
+        struct icon_theme_t *theme = app_first_theme_with_icon (&app, icon_name);
         assert (theme != NULL);
         app.selected_theme = theme;
     }
 
     app_set_icon_view (&app, icon_name);
+    app_prefetch_schedule (&app, fk_list_box, idx);
 }
 
 gboolean on_key_press (GtkWidget *widget, GdkEventKey *event, gpointer data) {
@@ -960,6 +2671,34 @@ gboolean search_filter (GtkListBoxRow *row, gpointer user_data)
     return strstr (icon_name, search_str) != NULL ? TRUE : FALSE;
 }
 
+// The All and Folder themes use an fk_list_box_t, *idx is an index into its
+// visible rows. Normal themes use a GtkListBox that hides rows with
+// search_filter(), *idx is an index among all of them and hidden ones are
+// skipped.
+const char* app_icon_list_step (struct app_t *app, struct fk_list_box_t *fk_list_box, int *idx, int dir)
+{
+    if (fk_list_box != NULL) {
+        int i = *idx + dir;
+        if (i < 0 || i >= fk_list_box->num_visible_rows) return NULL;
+
+        *idx = i;
+        return fk_list_box->visible_rows[i]->data;
+    }
+
+    GtkListBoxRow *row;
+    do {
+        if (*idx + dir < 0) return NULL;
+        *idx += dir;
+
+        row = gtk_list_box_get_row_at_index (GTK_LIST_BOX(app->icon_list), *idx);
+        if (row == NULL) return NULL;
+    } while (!search_filter (row, NULL));
+
+    GtkWidget *row_label = gtk_bin_get_child (GTK_BIN(row));
+    atom_t atom = atom_lookup (&app->atoms, gtk_label_get_text (GTK_LABEL(row_label)));
+    return atom != ATOM_NULL ? atom_str (&app->atoms, atom) : NULL;
+}
+
 // The only way to iterate through a GTree is using a callback an
 // g_tree_foreach, this is the callback that builds the "All" theme icon name
 // list.
@@ -984,23 +2723,20 @@ GtkWidget *icon_list_new (const char *theme_name, const char *selected_icon, con
     gtk_widget_set_hexpand (new_icon_list, TRUE);
     gtk_list_box_set_filter_func (GTK_LIST_BOX(new_icon_list), search_filter, NULL, NULL);
 
-    GList *icon_names = g_hash_table_get_keys (theme->icon_names);
-    icon_names = g_list_sort (icon_names, strcase_cmp_callback);
+    // Names are already sorted, so rows are added straight from the array.
+    // The selected icon is compared by atom instead of by string.
+    if (selected_icon == NULL && theme->num_icon_names > 0) {
+        selected_icon = atom_str (&app.atoms, theme->sorted_icon_names[0]);
+    }
+    atom_t selected_atom = selected_icon != NULL ? atom_lookup (&app.atoms, selected_icon) : ATOM_NULL;
 
-    bool first = true;
-    GList *l = NULL;
-    for (l = icon_names; l != NULL; l = l->next)
-    {
-        GtkWidget *row = gtk_label_new (l->data);
+    for (uint32_t i=0; i<theme->num_icon_names; i++) {
+        atom_t atom = theme->sorted_icon_names[i];
+        GtkWidget *row = gtk_label_new (atom_str (&app.atoms, atom));
         gtk_container_add (GTK_CONTAINER(new_icon_list), row);
         gtk_widget_set_halign (row, GTK_ALIGN_START);
 
-        if (selected_icon == NULL && first) {
-            first = false;
-            selected_icon = l->data;
-        }
-
-        if (strcmp (selected_icon, l->data) == 0) {
+        if (atom == selected_atom) {
             GtkWidget *r = gtk_widget_get_parent (row);
             gtk_list_box_select_row (GTK_LIST_BOX(new_icon_list), GTK_LIST_BOX_ROW(r));
         }
@@ -1010,7 +2746,6 @@ GtkWidget *icon_list_new (const char *theme_name, const char *selected_icon, con
         gtk_widget_set_margin_top (row, 3);
         gtk_widget_set_margin_bottom (row, 3);
     }
-    g_list_free (icon_names);
 
     *choosen_icon = selected_icon;
     g_signal_connect (G_OBJECT(new_icon_list), "row-selected", G_CALLBACK (on_icon_selected), NULL);
@@ -1048,6 +2783,7 @@ void on_theme_changed (GtkComboBox *themes_combobox, gpointer user_data)
     const char* theme_name = gtk_combo_box_get_active_id (themes_combobox);
     enum theme_type_t old_theme_type = app.selected_theme_type;
 
+    app_prefetch_cancel (&app);
     if (strcmp (theme_name, "All") == 0) {
         app_set_all_theme (&app);
 
@@ -1090,27 +2826,38 @@ void app_set_normal_theme (struct app_t *app, const char *theme_name, const char
     app_set_icon_view (app, app->selected_icon);
 }
 
+// Shows an empty icon view, for when there is no icon to show.
+void app_clear_icon_view (struct app_t *app)
+{
+    app_update_selected_icon (app, NULL);
+    replace_wrapped_widget_deferred (&app->icon_view_widget, gtk_grid_new ());
+}
+
 void app_set_all_theme (struct app_t *app)
 {
     app->selected_theme_type = THEME_TYPE_ALL;
 
-    // Set the selected theme as the first theme that contains the first icon in
-    // the All theme icon name list.
-    struct icon_theme_t *theme;
-    for (theme = app->themes; theme; theme = theme->next) {
-        if (g_hash_table_contains (theme->icon_names, app->all_icon_names_first)) break;
-    }
-    assert (theme != NULL && "Real theme for All theme not found");
-    app->selected_theme = theme;
-
-    replace_wrapped_widget (&app->icon_list, app->all_icon_names_widget);
-
     if (!GTK_IS_COMBO_BOX(app->theme_selector) ||
         gtk_combo_box_get_active_id (GTK_COMBO_BOX(app->theme_selector)) != g_intern_string ("All")) {
         GtkWidget *new_theme_selector = theme_selector_new ("All");
         replace_wrapped_widget_deferred (&app->theme_selector, new_theme_selector);
     }
 
+    replace_wrapped_widget (&app->icon_list, app->all_icon_names_widget);
+
+    // No theme finished loading yet. The first icon is shown by
+    // app_update_loaded_themes_ui() once one does.
+    if (app->all_icon_names_first == NULL) {
+        app_clear_icon_view (app);
+        return;
+    }
+
+    // Set the selected theme as the first theme that contains the first icon in
+    // the All theme icon name list.
+    struct icon_theme_t *theme = app_first_theme_with_icon (app, app->all_icon_names_first);
+    assert (theme != NULL && "Real theme for All theme not found");
+    app->selected_theme = theme;
+
     app_update_selected_icon (app, app->all_icon_names_first);
     app_set_icon_view (app, app->selected_icon);
 }
@@ -1119,27 +2866,8 @@ FK_LIST_BOX_ROW_SELECTED_CB (on_folder_theme_row_selected)
 {
     const char *icon_name = fk_list_box->visible_rows[idx]->data;
     struct icon_view_t *icon_view = g_tree_lookup (app.folder_theme_icon_names, icon_name);
-
-    // Unparent GtkImages before creating the new icon_view. draw_icon_view()
-    // will try to parent all image widgets, if we are showing this icon_view,
-    // then it will already have a parent and Gtk will complain. This can be
-    // removed if we stop using GtkImage to store images!.
-    for (int i=0; i<ARRAY_SIZE(icon_view->images); i++) {
-        struct icon_image_t *img = icon_view->images[i];
-
-        while (img != NULL) {
-            if (img->image != NULL) {
-                GtkWidget *parent = gtk_widget_get_parent (img->image);
-                if (parent != NULL)
-                    gtk_container_remove (GTK_CONTAINER(parent), img->image);
-            }
-            img = img->next;
-        }
-    }
-
-    icon_view->image_data_dpy = NULL;
-
     replace_wrapped_widget (&app.icon_view_widget, draw_icon_view (icon_view));
+    app_prefetch_schedule (&app, fk_list_box, idx);
 }
 
 ITERATE_DIR_CB (dir_watch_setup_cb)
@@ -1154,7 +2882,7 @@ int dir_watch_recursive (char *path)
 {
     int fd = inotify_init1 (O_NONBLOCK);
     if (fd != -1) {
-        iterate_dir (path, dir_watch_setup_cb, &fd);
+        iterate_dir_backend (path, app.scan_backend, dir_watch_setup_cb, &fd);
 
     } else {
         printf ("Failed to get a inotify instance.\n");
@@ -1217,6 +2945,7 @@ gboolean folder_theme_check_inotify (gpointer data)
 struct folder_theme_handle_file_path_clsr_t {
     char *path;
     GTree *icon_views;
+    struct icon_image_store_t *store;
     mem_pool_t *pool;
 };
 
@@ -1247,24 +2976,16 @@ ITERATE_DIR_CB (folder_theme_handle_file_path)
             for (int j=0; j<ARRAY_SIZE(patterns); j++) {
                 snprintf (buff, ARRAY_SIZE(buff), patterns[j], sizes[i]);
                 if (strstr(rel_fname, buff) != NULL) {
-                    struct icon_image_t *icon_image =
-                        mem_pool_push_size (clsr->pool, sizeof(struct icon_image_t));
-                    *icon_image = ZERO_INIT (struct icon_image_t);
-                    icon_image->scale = 1;
-                    icon_image->size = sizes[i];
-                    icon_image->theme_dir = pprintf (clsr->pool, "%s/", clsr->path);
-                    icon_image->path = pom_strdup (clsr->pool, fname + path_len + 1);
-                    icon_image->full_path = pom_strdup (clsr->pool, fname);
-
                     struct icon_view_t *icon_view;
                     if (!g_tree_lookup_extended (clsr->icon_views, icon_name, NULL, (void**)&icon_view)) {
                         icon_view = mem_pool_push_size (clsr->pool, sizeof(struct icon_view_t));
-                        *icon_view = ZERO_INIT (struct icon_view_t);
+                        icon_view_init (icon_view, clsr->store);
                         icon_view->icon_name = pom_strdup (clsr->pool, icon_name);
                         g_tree_insert (clsr->icon_views, icon_name, icon_view);
                     }
 
-                    icon_view_push_image (icon_view, icon_image);
+                    uint32_t id = icon_view_push_image (icon_view, 1, fname, path_len + 1);
+                    clsr->store->size[id] = sizes[i];
                 }
             }
         }
@@ -1294,8 +3015,9 @@ bool app_set_folder_theme (struct app_t *app, char *path)
         struct folder_theme_handle_file_path_clsr_t clsr;
         clsr.path = path;
         clsr.icon_views = icon_views;
+        clsr.store = icon_image_store_new (&pool);
         clsr.pool = &pool;
-        iterate_dir (path, folder_theme_handle_file_path, &clsr);
+        iterate_dir_backend (path, app->scan_backend, folder_theme_handle_file_path, &clsr);
         g_tree_foreach (icon_views, folder_theme_foreach_icon_view, clsr.pool);
     }
 
@@ -1328,6 +3050,9 @@ bool app_set_folder_theme (struct app_t *app, char *path)
             replace_wrapped_widget (&app->icon_view_widget, draw_icon_view (selected_icon_view));
         }
 
+        // Queued prefetches point into the old icon views.
+        app_prefetch_cancel (app);
+
         // Replace the GTree folder_theme_icon_names
         if (app->folder_theme_icon_names != NULL)
             g_tree_destroy (app->folder_theme_icon_names);
@@ -1358,8 +3083,21 @@ bool app_set_folder_theme (struct app_t *app, char *path)
     return something_found;
 }
 
+void fk_list_box_search_filter (struct fk_list_box_t *fk_list_box)
+{
+    const gchar *search_str = gtk_entry_get_text (GTK_ENTRY(app.search_entry));
+    for (int i=0; i<fk_list_box->num_rows; i++) {
+        const char *icon_name = fk_list_box->rows[i].data;
+        fk_list_box->rows[i].hidden = (strstr (icon_name, search_str) == NULL);
+    }
+    fk_list_box_refresh_hidden (fk_list_box);
+}
+
 void on_search_changed (GtkEditable *search_entry, gpointer user_data)
 {
+    // Rows next to the selected one are different now.
+    app_prefetch_cancel (&app);
+
     if (app.selected_theme_type == THEME_TYPE_NORMAL) {
         gtk_list_box_invalidate_filter (GTK_LIST_BOX(app.icon_list));
 
@@ -1368,13 +3106,7 @@ void on_search_changed (GtkEditable *search_entry, gpointer user_data)
 
         struct fk_list_box_t *fk_list_box = app.selected_theme_type == THEME_TYPE_ALL ?
             &app.all_theme_fk_list_box : app.folder_theme_fk_list_box;
-
-        const gchar *search_str = gtk_entry_get_text (GTK_ENTRY(search_entry));
-        for (int i=0; i<fk_list_box->num_rows; i++) {
-            const char *icon_name = fk_list_box->rows[i].data;
-            fk_list_box->rows[i].hidden = (strstr (icon_name, search_str) == NULL);
-        }
-        fk_list_box_refresh_hidden (fk_list_box);
+        fk_list_box_search_filter (fk_list_box);
     }
 }
 
@@ -1407,12 +3139,71 @@ gboolean delete_callback (GtkWidget *widget, GdkEvent *event, gpointer user_data
     return FALSE;
 }
 
-gboolean all_theme_row_build (gpointer key, gpointer value, gpointer data)
+// Called from the main loop after themes finished loading. Rebuilds the
+// widgets that depend on the set of loaded themes, keeping what the user
+// selected.
+void app_update_loaded_themes_ui (struct app_t *app)
 {
-    struct fk_list_box_t *fk_list_box = (struct fk_list_box_t *)data;
-    struct fk_list_box_row_t *row = fk_list_box_row_new (fk_list_box);
-    row->data = key;
-    return FALSE;
+    if (app->window == NULL) return;
+
+    struct fk_list_box_t *all_fk_list_box = &app->all_theme_fk_list_box;
+    void *selected_icon_name =
+        all_fk_list_box->selected_row != NULL ? all_fk_list_box->selected_row->data : NULL;
+
+    fk_list_box_rows_start (all_fk_list_box, app->num_all_icon_names);
+    for (uint32_t i=0; i<app->num_all_icon_names; i++) {
+        struct fk_list_box_row_t *row = fk_list_box_row_new (all_fk_list_box);
+        row->data = (char*)atom_str (&app->atoms, app->all_icon_names[i]);
+    }
+    fk_list_box_search_filter (all_fk_list_box);
+    if (all_fk_list_box->num_rows > 0) {
+        app->all_icon_names_first = all_fk_list_box->rows[0].data;
+    }
+
+    // Nothing is shown yet, show the All theme as soon as it has icons.
+    bool is_first_show = app->selected_theme_type == THEME_TYPE_ALL && app->selected_icon == NULL;
+
+    bool keeps_selection = selected_icon_name != NULL &&
+        fk_list_box_set_selected_data (all_fk_list_box, selected_icon_name);
+    if (!keeps_selection && app->selected_theme_type == THEME_TYPE_ALL && app->selected_icon != NULL) {
+        // The shown icon isn't a visible row anymore, show the first visible
+        // one instead, or nothing if the search hides them all.
+        if (all_fk_list_box->num_visible_rows > 0) {
+            fk_list_box_change_selected (all_fk_list_box, 0);
+        } else {
+            all_fk_list_box->selected_row = NULL;
+            app_clear_icon_view (app);
+        }
+    }
+
+    if (is_first_show) {
+        if (all_fk_list_box->num_visible_rows > 0) {
+            app_set_all_theme (app);
+        }
+
+    } else {
+        const char *theme_name = NULL;
+        if (app->selected_theme_type == THEME_TYPE_ALL) {
+            theme_name = "All";
+        } else if (app->selected_theme_type == THEME_TYPE_NORMAL) {
+            theme_name = app->selected_theme->name;
+        }
+        GtkWidget *new_theme_selector = theme_selector_new (theme_name);
+        replace_wrapped_widget_deferred (&app->theme_selector, new_theme_selector);
+    }
+
+    struct theme_loader_t *loader = &app->loader;
+    int num_found = g_atomic_int_get (&loader->num_found);
+    if (g_atomic_int_get (&loader->is_done) && loader->num_ready == num_found) {
+        gtk_widget_hide (app->loading_progress);
+
+    } else if (num_found > 0) {
+        char *text = g_strdup_printf ("Loading icon themes (%d/%d)", loader->num_ready, num_found);
+        gtk_progress_bar_set_text (GTK_PROGRESS_BAR(app->loading_progress), text);
+        gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR(app->loading_progress),
+                                       (double)loader->num_ready/num_found);
+        g_free (text);
+    }
 }
 
 #define new_icon_button(icon_name,click_handler) new_icon_button_gcallback(icon_name,G_CALLBACK(click_handler))
@@ -1428,12 +3219,112 @@ int main(int argc, char *argv[])
 {
     app = (struct app_t){
 #define EXTENSION(name,str) str,
-        .valid_extensions = { VALID_EXTENSIONS }
+        .valid_extensions = { VALID_EXTENSIONS },
 #undef EXTENSION
+        .image_cache_budget = IMAGE_CACHE_DEFAULT_BUDGET
     };
 
     gtk_init(&argc, &argv);
 
+    // NOTE: gtk_init() already removed the arguments it understands.
+    char *folder_path = NULL;
+    for (int i=1; i<argc; i++) {
+        if (strcmp (argv[i], "--threads") == 0 || strcmp (argv[i], "-j") == 0) {
+            if (i+1 < argc) {
+                i++;
+                app.max_scan_threads = atoi (argv[i]);
+            } else {
+                printf ("Missing number of threads after '%s'.\n", argv[i]);
+            }
+
+        } else if (strcmp (argv[i], "--diagnostics") == 0) {
+            app.diagnostics = true;
+
+        } else if (strcmp (argv[i], "--scan-backend") == 0) {
+            if (i+1 < argc) {
+                i++;
+                if (strcmp (argv[i], "readdir") == 0) {
+                    app.scan_backend = DIR_READER_READDIR;
+                } else if (strcmp (argv[i], "getdents") == 0) {
+                    app.scan_backend = DIR_READER_GETDENTS;
+                } else {
+                    printf ("Unknown scan backend '%s', expected readdir or getdents.\n", argv[i]);
+                }
+            } else {
+                printf ("Missing backend name after '%s'.\n", argv[i]);
+            }
+
+        } else if (strcmp (argv[i], "--scan-benchmark") == 0) {
+            app.scan_benchmark = true;
+
+        } else if (strcmp (argv[i], "--map-benchmark") == 0) {
+            app.map_benchmark = true;
+
+        } else if (strcmp (argv[i], "--probe-benchmark") == 0) {
+            app.probe_benchmark = true;
+
+        } else if (strcmp (argv[i], "--pool-selftest") == 0) {
+            app.pool_selftest = true;
+
+        } else if (strcmp (argv[i], "--image-cache-size") == 0) {
+            if (i+1 < argc) {
+                i++;
+                // Size is in MiB, 0 disables the cache.
+                app.image_cache_budget = (size_t)MAX (atoi (argv[i]), 0)*1024*1024;
+            } else {
+                printf ("Missing size in MiB after '%s'.\n", argv[i]);
+            }
+
+        } else if (strcmp (argv[i], "--image-cache-stats") == 0) {
+            app.image_cache_stats = true;
+
+        } else if (folder_path == NULL) {
+            folder_path = argv[i];
+
+        } else {
+            printf ("Ignoring unexpected argument '%s'.\n", argv[i]);
+        }
+    }
+
+    if (app.diagnostics) {
+        app_load_all_icon_themes (&app);
+        for (struct icon_theme_t *theme = app.themes; theme; theme = theme->next) {
+            icon_theme_print_diagnostics (theme);
+        }
+        app_destroy (&app);
+        return 0;
+    }
+
+    if (app.scan_benchmark) {
+        app_load_all_icon_themes (&app);
+        app_scan_benchmark (&app);
+        app_destroy (&app);
+        return 0;
+    }
+
+    if (app.map_benchmark) {
+        app_load_all_icon_themes (&app);
+        app_map_benchmark (&app);
+        app_destroy (&app);
+        return 0;
+    }
+
+    if (app.probe_benchmark) {
+        app_load_all_icon_themes (&app);
+        app_probe_benchmark (&app);
+        app_destroy (&app);
+        return 0;
+    }
+
+    if (app.pool_selftest) {
+        bool success = pool_selftest_run ();
+        app_destroy (&app);
+        return success ? 0 : 1;
+    }
+
+    image_cache_init (&app.image_cache, app.image_cache_budget);
+    image_decoder_init (&app.image_decoder, &app.image_cache);
+
     app.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_resize (GTK_WINDOW(app.window), 970, 650);
     gtk_window_set_position(GTK_WINDOW(app.window), GTK_WIN_POS_CENTER);
@@ -1449,50 +3340,50 @@ int main(int argc, char *argv[])
     g_signal_connect (G_OBJECT(app.window), "delete-event", G_CALLBACK (delete_callback), NULL);
     g_signal_connect (G_OBJECT(app.window), "key-press-event", G_CALLBACK (on_key_press), NULL);
 
-    app_load_all_icon_themes (&app);
+    // Themes are added to the UI from the main loop as they finish loading, so
+    // the window is shown before they are found.
+    app_load_all_icon_themes_start (&app);
 
     app.search_entry = gtk_search_entry_new ();
     g_signal_connect (G_OBJECT(app.search_entry), "changed", G_CALLBACK (on_search_changed), NULL);
 
-    app.icon_list = gtk_grid_new (); // Placeholder
+    app.all_icon_names_widget = fk_list_box_init (&app.all_theme_fk_list_box,
+                                                  on_all_theme_row_selected);
+    g_object_ref_sink (app.all_icon_names_widget);
+
+    // Start showing the All theme, empty until the first theme is loaded.
+    app.selected_theme_type = THEME_TYPE_ALL;
+    app.icon_list = app.all_icon_names_widget;
     GtkWidget *scrolled_icon_list = gtk_scrolled_window_new (NULL, NULL);
     gtk_scrolled_window_disable_hscroll (GTK_SCROLLED_WINDOW(scrolled_icon_list));
     gtk_container_add (GTK_CONTAINER (scrolled_icon_list), app.icon_list);
 
-    app.theme_selector = gtk_grid_new (); // Placeholder
+    app.theme_selector = theme_selector_new ("All");
+
+    app.loading_progress = gtk_progress_bar_new ();
+    gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR(app.loading_progress), TRUE);
+    gtk_progress_bar_set_text (GTK_PROGRESS_BAR(app.loading_progress), "Loading icon themes…");
 
     GtkWidget *sidebar = gtk_grid_new ();
     gtk_widget_set_size_request (sidebar, 200, 0);
     gtk_grid_attach (GTK_GRID(sidebar), app.search_entry, 0, 0, 1, 1);
     gtk_grid_attach (GTK_GRID(sidebar), scrolled_icon_list, 0, 1, 1, 1);
     gtk_grid_attach (GTK_GRID(sidebar), wrap_gtk_widget(app.theme_selector), 0, 2, 1, 1);
+    gtk_grid_attach (GTK_GRID(sidebar), app.loading_progress, 0, 3, 1, 1);
 
     app.icon_view_widget = gtk_grid_new (); // Placeholder
     GtkWidget *paned = fix_gtk_paned_new (GTK_ORIENTATION_HORIZONTAL);
     gtk_paned_pack1 (GTK_PANED(paned), sidebar, FALSE, FALSE);
     gtk_paned_pack2 (GTK_PANED(paned), wrap_gtk_widget(app.icon_view_widget), TRUE, TRUE);
 
-    app.all_icon_names_widget = fk_list_box_init (&app.all_theme_fk_list_box,
-                                                  on_all_theme_row_selected);
-    fk_list_box_rows_start (&app.all_theme_fk_list_box, g_tree_nnodes(app.all_icon_names));
-    g_tree_foreach (app.all_icon_names, all_theme_row_build, &app.all_theme_fk_list_box);
-
-    app.all_icon_names_first = app.all_theme_fk_list_box.rows[0].data;
-    g_object_ref_sink (app.all_icon_names_widget);
-
-    bool folder_theme_used = false;
-    if (argc == 2) {
-        char *argv1_abs = abs_path (argv[1], NULL);
-        if (argv1_abs != NULL && dir_exists (argv1_abs)) {
-            folder_theme_used = app_set_folder_theme (&app, argv[1]);
+    if (folder_path != NULL) {
+        char *folder_path_abs = abs_path (folder_path, NULL);
+        if (folder_path_abs != NULL && dir_exists (folder_path_abs)) {
+            app_set_folder_theme (&app, folder_path);
         } else {
-            printf ("Could not set '%s' as folder theme.", argv[1]);
+            printf ("Could not set '%s' as folder theme.", folder_path);
         }
-        free (argv1_abs);
-    }
-
-    if (!folder_theme_used) {
-        app_set_all_theme (&app);
+        free (folder_path_abs);
     }
 
     gtk_container_add(GTK_CONTAINER(app.window), paned);
@@ -1503,6 +3394,10 @@ int main(int argc, char *argv[])
 
     gtk_main();
 
+    if (app.image_cache_stats) {
+        image_cache_print_stats (&app.image_cache);
+    }
+
     // Not really necessary because memory will be freed anyway, but useful if
     // we ever want to run valgrind on the application. It's not freed
     // automatically because we sunk this widget so it didn't get destroyed when
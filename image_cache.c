@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Cache of decoded images, shared by the icon views of all theme types.
+//
+// Showing an icon drops the images of the previous icon, so going back and
+// forth between icons or themes decoded the same files over and over. Decoded
+// images are kept here as Cairo image surfaces, ready to be painted by the
+// icon strip. They are keyed by the file's device, inode and modification
+// time (so a file that changed is decoded again) and the scale it's shown at.
+// Many paths can lead to the same file through symlinks, themes link a lot,
+// they all share an entry.
+//
+// The cache holds a reference to each surface, and has a budget in bytes of
+// pixel data. When it's exceeded, the least recently used entries are
+// evicted. Surfaces that are still shown aren't freed until their store is
+// cleared, evicting only drops the cache's reference.
+//
+// Only used from the main thread.
+
+struct image_cache_key_t {
+    dev_t dev;
+    ino_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t scale;
+};
+
+struct image_cache_entry_t {
+    struct image_cache_key_t key;
+    cairo_surface_t *surface;
+    size_t size;
+
+    // LRU list, from most to least recently used.
+    struct image_cache_entry_t *prev;
+    struct image_cache_entry_t *next;
+};
+
+#define IMAGE_CACHE_DEFAULT_BUDGET (64*1024*1024)
+
+struct image_cache_t {
+    size_t budget;
+    size_t size;
+
+    // Maps struct image_cache_key_t* to the struct image_cache_entry_t that
+    // contains the key.
+    GHashTable *entries;
+    // Sentinel of the LRU list.
+    struct image_cache_entry_t lru;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// A zeroed key is invalid, it's used for files that couldn't be stat()ed and
+// never matches any entry.
+static inline
+bool image_cache_key_is_valid (struct image_cache_key_t *key)
+{
+    return key->ino != 0;
+}
+
+void image_cache_key_from_stat (struct stat *st, uint32_t scale, struct image_cache_key_t *key)
+{
+    *key = ZERO_INIT (struct image_cache_key_t);
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+    key->scale = scale;
+}
+
+guint image_cache_key_hash (gconstpointer data)
+{
+    const struct image_cache_key_t *key = data;
+    uint64_t h = (uint64_t)key->ino*0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)key->dev + (h << 6) + (h >> 2);
+    h ^= (uint64_t)key->mtime_nsec + (h << 6) + (h >> 2);
+    h ^= (uint64_t)key->scale + (h << 6) + (h >> 2);
+    return (guint)(h ^ (h >> 32));
+}
+
+gboolean image_cache_key_equal (gconstpointer a_data, gconstpointer b_data)
+{
+    const struct image_cache_key_t *a = a_data, *b = b_data;
+    return a->ino == b->ino && a->dev == b->dev &&
+        a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+        a->scale == b->scale;
+}
+
+void image_cache_init (struct image_cache_t *cache, size_t budget)
+{
+    *cache = ZERO_INIT (struct image_cache_t);
+    cache->budget = budget;
+    cache->entries = g_hash_table_new (image_cache_key_hash, image_cache_key_equal);
+    cache->lru.prev = &cache->lru;
+    cache->lru.next = &cache->lru;
+}
+
+static inline
+void image_cache_lru_remove (struct image_cache_entry_t *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+static inline
+void image_cache_lru_push_front (struct image_cache_t *cache, struct image_cache_entry_t *entry)
+{
+    entry->prev = &cache->lru;
+    entry->next = cache->lru.next;
+    cache->lru.next->prev = entry;
+    cache->lru.next = entry;
+}
+
+void image_cache_entry_remove (struct image_cache_t *cache, struct image_cache_entry_t *entry)
+{
+    g_hash_table_remove (cache->entries, &entry->key);
+    image_cache_lru_remove (entry);
+    cache->size -= entry->size;
+    cairo_surface_destroy (entry->surface);
+    free (entry);
+}
+
+void image_cache_destroy (struct image_cache_t *cache)
+{
+    if (cache->entries == NULL) return;
+
+    while (cache->lru.next != &cache->lru) {
+        image_cache_entry_remove (cache, cache->lru.next);
+    }
+    g_hash_table_destroy (cache->entries);
+    *cache = ZERO_INIT (struct image_cache_t);
+}
+
+// Returns a surface owned by the cache, or NULL if key isn't cached. Take a
+// reference to keep it after the next call to image_cache_insert().
+cairo_surface_t* image_cache_lookup (struct image_cache_t *cache, struct image_cache_key_t *key)
+{
+    if (cache->entries == NULL || !image_cache_key_is_valid (key)) return NULL;
+
+    struct image_cache_entry_t *entry = g_hash_table_lookup (cache->entries, key);
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache->hits++;
+    image_cache_lru_remove (entry);
+    image_cache_lru_push_front (cache, entry);
+    return entry->surface;
+}
+
+// Unlike image_cache_lookup(), doesn't count as a hit or miss, and doesn't
+// make the entry more recently used.
+bool image_cache_contains (struct image_cache_t *cache, struct image_cache_key_t *key)
+{
+    return cache->entries != NULL && image_cache_key_is_valid (key) &&
+        g_hash_table_contains (cache->entries, key);
+}
+
+// Adds surface, a Cairo image surface, to the cache taking a reference to it,
+// then evicts least recently used entries until the cache is within budget.
+// Surfaces larger than the whole budget aren't cached.
+void image_cache_insert (struct image_cache_t *cache, struct image_cache_key_t *key, cairo_surface_t *surface)
+{
+    if (cache->entries == NULL || !image_cache_key_is_valid (key)) return;
+
+    size_t size = (size_t)cairo_image_surface_get_stride (surface)*cairo_image_surface_get_height (surface);
+    if (size > cache->budget || g_hash_table_contains (cache->entries, key)) {
+        return;
+    }
+
+    struct image_cache_entry_t *entry = malloc (sizeof(struct image_cache_entry_t));
+    entry->key = *key;
+    entry->surface = cairo_surface_reference (surface);
+    entry->size = size;
+    g_hash_table_insert (cache->entries, &entry->key, entry);
+    image_cache_lru_push_front (cache, entry);
+    cache->size += size;
+
+    while (cache->size > cache->budget) {
+        image_cache_entry_remove (cache, cache->lru.prev);
+        cache->evictions++;
+    }
+}
+
+void image_cache_print_stats (struct image_cache_t *cache)
+{
+    uint64_t lookups = cache->hits + cache->misses;
+    printf ("Image cache: %u entries, %zu of %zu bytes\n",
+            g_hash_table_size (cache->entries), cache->size, cache->budget);
+    printf ("  hits: %"PRIu64" (%.1f%%), misses: %"PRIu64", evictions: %"PRIu64"\n",
+            cache->hits, lookups > 0 ? 100.0*cache->hits/lookups : 0.0,
+            cache->misses, cache->evictions);
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Decodes the images of the icon view in a pool of worker threads.
+//
+// Large SVGs and 512px PNGs take tens of milliseconds each to decode, doing it
+// for all images of an icon in the main thread made clicking on icons hitch.
+// Instead, icon views are laid out with the size the image will have, and each
+// image is decoded by a worker with a GdkPixbufLoader (gdk-pixbuf is thread
+// safe, GTK isn't). The worker also converts the pixbuf into the Cairo image
+// surface the icon strip paints, so the main thread never touches pixels.
+// Decoded surfaces are pushed into a queue that's drained from the main loop,
+// which hands them to the icon view.
+//
+// Requests are tagged with the generation they were made in. Showing a
+// different icon view starts a new generation, so results for images that
+// aren't shown anymore are dropped, both before decoding them (if the worker
+// didn't get to them yet) and when they reach the main thread. The store of
+// an old generation may have been cleared or destroyed already, its pointer
+// is never dereferenced. Images that were decoded are added to the image
+// cache even if they are stale, the work was already done.
+//
+// Prefetch requests only fill the cache, they have no store. They have their
+// own generation, so showing an icon doesn't cancel them, and workers pick
+// them only after all requests for images being shown.
+
+void icon_view_image_decoded (struct icon_image_store_t *store, uint32_t id, cairo_surface_t *surface);
+
+struct image_decoder_t {
+    GThreadPool *workers;
+    GAsyncQueue *done;
+    gint generation;
+    gint prefetch_generation;
+    uint32_t num_requests;
+
+    struct image_cache_t *cache; // can be NULL
+};
+
+struct image_decode_job_t {
+    struct image_decoder_t *decoder;
+    gint generation;
+    bool is_prefetch;
+    uint32_t seq;
+
+    struct icon_image_store_t *store;
+    uint32_t id;
+    char *path;
+    struct image_cache_key_t key;
+
+    cairo_surface_t *surface;
+};
+
+static inline
+bool image_decode_job_is_stale (struct image_decode_job_t *job)
+{
+    gint *generation = job->is_prefetch ?
+        &job->decoder->prefetch_generation : &job->decoder->generation;
+    return job->generation != g_atomic_int_get (generation);
+}
+
+// Requests for images being shown go before prefetches, otherwise in the order
+// they were made.
+gint image_decode_job_cmp (gconstpointer a_data, gconstpointer b_data, gpointer user_data)
+{
+    const struct image_decode_job_t *a = a_data, *b = b_data;
+    if (a->is_prefetch != b->is_prefetch) {
+        return a->is_prefetch ? 1 : -1;
+    }
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+void image_decode_job_destroy (struct image_decode_job_t *job)
+{
+    if (job->surface != NULL) {
+        cairo_surface_destroy (job->surface);
+    }
+    free (job);
+}
+
+// Returns NULL if the file can't be read or decoded.
+GdkPixbuf* image_decode_file (const char *path)
+{
+    // File contents are only needed until the loader is closed, they are
+    // read into the pool of the worker thread.
+    mem_pool_t *pool = mem_pool_thread_local ();
+    uint64_t len;
+    char *data = full_file_read (pool, path, &len);
+    if (data == NULL) {
+        mem_pool_reset (pool);
+        return NULL;
+    }
+
+    GError *error = NULL;
+    GdkPixbufLoader *loader = gdk_pixbuf_loader_new ();
+    bool success = gdk_pixbuf_loader_write (loader, (const guchar*)data, len, &error);
+    // NOTE: The loader must always be closed, even if writing failed.
+    success = gdk_pixbuf_loader_close (loader, success ? &error : NULL) && success;
+    mem_pool_reset (pool);
+
+    GdkPixbuf *pixbuf = NULL;
+    if (success) {
+        pixbuf = gdk_pixbuf_loader_get_pixbuf (loader);
+        if (pixbuf != NULL) {
+            g_object_ref (pixbuf);
+        }
+
+    } else {
+        printf ("Error decoding %s: %s\n", path, error != NULL ? error->message : "unknown error");
+    }
+
+    if (error != NULL) {
+        g_error_free (error);
+    }
+    g_object_unref (loader);
+    return pixbuf;
+}
+
+// Converts pixbuf into a premultiplied ARGB32 surface (RGB24 if it has no
+// alpha), the format Cairo paints fastest. This is what
+// gdk_cairo_surface_create_from_pixbuf() does, but that's part of GDK, which
+// isn't thread safe. Returns NULL if the surface can't be created.
+cairo_surface_t* image_surface_from_pixbuf (GdkPixbuf *pixbuf)
+{
+    int width = gdk_pixbuf_get_width (pixbuf);
+    int height = gdk_pixbuf_get_height (pixbuf);
+    int num_channels = gdk_pixbuf_get_n_channels (pixbuf);
+    bool has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+    int src_stride = gdk_pixbuf_get_rowstride (pixbuf);
+    const guchar *src = gdk_pixbuf_get_pixels (pixbuf);
+
+    cairo_surface_t *surface =
+        cairo_image_surface_create (has_alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24, width, height);
+    if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy (surface);
+        return NULL;
+    }
+
+    cairo_surface_flush (surface);
+    uint8_t *dst = cairo_image_surface_get_data (surface);
+    int dst_stride = cairo_image_surface_get_stride (surface);
+    for (int y=0; y<height; y++) {
+        const guchar *s = src + y*src_stride;
+        // Cairo pixels are native endian 32 bit words, 0xAARRGGBB.
+        uint32_t *d = (uint32_t*)(dst + y*dst_stride);
+        for (int x=0; x<width; x++) {
+            uint32_t r = s[0], g = s[1], b = s[2], a = 0xFF;
+            if (has_alpha) {
+                a = s[3];
+                r = (r*a + 127)/255;
+                g = (g*a + 127)/255;
+                b = (b*a + 127)/255;
+            }
+            d[x] = a<<24 | r<<16 | g<<8 | b;
+            s += num_channels;
+        }
+    }
+    cairo_surface_mark_dirty (surface);
+    return surface;
+}
+
+gboolean image_decoder_done_idle (gpointer user_data);
+
+void image_decode_job_run (gpointer data, gpointer user_data)
+{
+    struct image_decode_job_t *job = (struct image_decode_job_t*)data;
+    if (!image_decode_job_is_stale (job)) {
+        GdkPixbuf *pixbuf = image_decode_file (job->path);
+        if (pixbuf != NULL) {
+            job->surface = image_surface_from_pixbuf (pixbuf);
+            g_object_unref (pixbuf);
+        }
+    }
+
+    g_async_queue_push (job->decoder->done, job);
+    g_idle_add (image_decoder_done_idle, job->decoder);
+}
+
+void image_decoder_init (struct image_decoder_t *decoder, struct image_cache_t *cache)
+{
+    *decoder = ZERO_INIT (struct image_decoder_t);
+    decoder->cache = cache;
+
+    // Icons have a handful of images, there's no point in using all
+    // processors. Keep one for the main thread.
+    int num_threads = CLAMP (g_get_num_processors () - 1, 1, 4);
+    decoder->workers = g_thread_pool_new (image_decode_job_run, NULL, num_threads, FALSE, NULL);
+    g_thread_pool_set_sort_function (decoder->workers, image_decode_job_cmp, NULL);
+    decoder->done = g_async_queue_new ();
+}
+
+void image_decoder_destroy (struct image_decoder_t *decoder)
+{
+    if (decoder->workers == NULL) return;
+
+    // Pending requests become stale so workers skip decoding them, but still
+    // run them so they end up in the queue and are freed.
+    g_atomic_int_inc (&decoder->generation);
+    g_atomic_int_inc (&decoder->prefetch_generation);
+    g_thread_pool_free (decoder->workers, FALSE, TRUE);
+
+    struct image_decode_job_t *job;
+    while ((job = g_async_queue_try_pop (decoder->done)) != NULL) {
+        image_decode_job_destroy (job);
+    }
+    g_async_queue_unref (decoder->done);
+    *decoder = ZERO_INIT (struct image_decoder_t);
+}
+
+// Drops all requests made until now, except prefetches. Must be called from
+// the main thread.
+void image_decoder_next_generation (struct image_decoder_t *decoder)
+{
+    g_atomic_int_inc (&decoder->generation);
+}
+
+// Drops all prefetch requests made until now. Must be called from the main
+// thread.
+void image_decoder_cancel_prefetches (struct image_decoder_t *decoder)
+{
+    g_atomic_int_inc (&decoder->prefetch_generation);
+}
+
+void image_decoder_push (struct image_decoder_t *decoder, bool is_prefetch,
+                         struct icon_image_store_t *store, uint32_t id, const char *path,
+                         struct image_cache_key_t *key)
+{
+    if (decoder->workers == NULL) return;
+
+    size_t path_len = strlen (path);
+    struct image_decode_job_t *job = malloc (sizeof(struct image_decode_job_t) + path_len + 1);
+    *job = ZERO_INIT (struct image_decode_job_t);
+    job->decoder = decoder;
+    job->is_prefetch = is_prefetch;
+    job->generation = g_atomic_int_get (is_prefetch ? &decoder->prefetch_generation : &decoder->generation);
+    job->seq = decoder->num_requests++;
+    job->store = store;
+    job->id = id;
+    job->key = *key;
+    job->path = (char*)(job + 1);
+    memcpy (job->path, path, path_len + 1);
+
+    g_thread_pool_push (decoder->workers, job, NULL);
+}
+
+// Decodes the file at path in a worker, and calls icon_view_image_decoded()
+// with store and id from the main loop once it's done, unless a new generation
+// was started before that. The result is cached with key. Must be called from
+// the main thread.
+void image_decoder_request (struct image_decoder_t *decoder,
+                            struct icon_image_store_t *store, uint32_t id, const char *path,
+                            struct image_cache_key_t *key)
+{
+    image_decoder_push (decoder, false, store, id, path, key);
+}
+
+// Decodes the file at path in a worker only to add it to the cache with key.
+// Must be called from the main thread.
+void image_decoder_prefetch (struct image_decoder_t *decoder, const char *path,
+                             struct image_cache_key_t *key)
+{
+    if (decoder->cache == NULL) return;
+    image_decoder_push (decoder, true, NULL, ICON_IMAGE_NONE, path, key);
+}
+
+gboolean image_decoder_done_idle (gpointer user_data)
+{
+    struct image_decoder_t *decoder = (struct image_decoder_t*)user_data;
+    if (decoder->done == NULL) return FALSE;
+
+    struct image_decode_job_t *job;
+    while ((job = g_async_queue_try_pop (decoder->done)) != NULL) {
+        if (job->surface != NULL) {
+            if (decoder->cache != NULL) {
+                image_cache_insert (decoder->cache, &job->key, job->surface);
+            }
+
+            if (!job->is_prefetch && !image_decode_job_is_stale (job)) {
+                icon_view_image_decoded (job->store, job->id, job->surface);
+            }
+        }
+        image_decode_job_destroy (job);
+    }
+    return FALSE;
+}
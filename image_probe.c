@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Gets the dimensions of an image by reading only the start of the file,
+// without decoding any pixels. Supports the formats icon themes use:
+//
+//  - PNG: The IHDR chunk is always the first one, width and height are at a
+//    fixed offset.
+//  - SVG: The width, height and viewBox attributes of the root element, the
+//    way librsvg computes the size gdk-pixbuf renders them at. Inkscape puts
+//    lots of namespace declarations before them, so a few KB are read.
+//  - XPM: The first string of the file, "<width> <height> <colors> <cpp>".
+//
+// The file is opened once and fstat()ed, so callers get everything the
+// metadata of an image needs from a single open() and read().
+
+#define IMAGE_PROBE_READ_SIZE 4096
+
+// Unlike is_space(), includes line breaks, attributes are usually one per line.
+static inline
+bool image_probe_is_space (const char *c)
+{
+    return *c == ' ' || *c == '\t' || *c == '\n' || *c == '\r';
+}
+
+static inline
+uint32_t image_probe_be32 (const uint8_t *p)
+{
+    return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | (uint32_t)p[3];
+}
+
+bool image_probe_png (const uint8_t *data, size_t len, double *width, double *height)
+{
+    static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (len < 24 || memcmp (data, signature, sizeof(signature)) != 0 ||
+        memcmp (data + 12, "IHDR", 4) != 0) {
+        return false;
+    }
+
+    // NOTE: PNG requires both to be greater than 0.
+    uint32_t w = image_probe_be32 (data + 16);
+    uint32_t h = image_probe_be32 (data + 20);
+    if (w == 0 || h == 0) {
+        return false;
+    }
+
+    *width = w;
+    *height = h;
+    return true;
+}
+
+bool image_probe_xpm (const char *data, double *width, double *height)
+{
+    if (strncmp (data, "/* XPM */", 9) != 0) {
+        return false;
+    }
+
+    const char *values = strchr (data, '{');
+    values = values != NULL ? strchr (values, '"') : NULL;
+
+    int w, h;
+    if (values == NULL || sscanf (values + 1, "%d %d", &w, &h) != 2 || w <= 0 || h <= 0) {
+        return false;
+    }
+
+    *width = w;
+    *height = h;
+    return true;
+}
+
+// Parses an SVG length into pixels, at the 90 DPI librsvg uses by default.
+// Returns false for relative units (%, em, ex), those depend on a viewport we
+// don't have.
+bool image_probe_svg_length (const char *str, size_t len, double *value)
+{
+    char buff[32];
+    if (len >= ARRAY_SIZE(buff)) return false;
+    memcpy (buff, str, len);
+    buff[len] = '\0';
+
+    char *unit;
+    double v = strtod (buff, &unit);
+    if (unit == buff || v <= 0) return false;
+
+    while (image_probe_is_space (unit)) unit++;
+    if (*unit == '\0' || strcmp (unit, "px") == 0) {
+        *value = v;
+    } else if (strcmp (unit, "pt") == 0) {
+        *value = v*90/72;
+    } else if (strcmp (unit, "pc") == 0) {
+        *value = v*90/6;
+    } else if (strcmp (unit, "in") == 0) {
+        *value = v*90;
+    } else if (strcmp (unit, "cm") == 0) {
+        *value = v*90/2.54;
+    } else if (strcmp (unit, "mm") == 0) {
+        *value = v*90/25.4;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool image_probe_svg (const char *data, double *width, double *height)
+{
+    // Find the root element, skipping the XML declaration, comments and
+    // doctype. The attributes must be complete within what was read.
+    const char *pos = data;
+    while ((pos = strchr (pos, '<')) != NULL) {
+        if (strncmp (pos, "<!--", 4) == 0) {
+            pos = strstr (pos + 4, "-->");
+            if (pos == NULL) return false;
+
+        } else if (strncmp (pos, "<svg", 4) == 0 &&
+                   (image_probe_is_space (pos + 4) || pos[4] == '>' || pos[4] == '/')) {
+            break;
+        }
+        pos++;
+    }
+    if (pos == NULL) return false;
+    pos += 4;
+
+    bool has_width = false, has_height = false, has_view_box = false;
+    double w = 0, h = 0, vb_w = 0, vb_h = 0;
+    while (true) {
+        while (image_probe_is_space (pos)) pos++;
+        if (*pos == '\0') return false;
+        if (*pos == '>' || *pos == '/') break;
+
+        const char *name = pos;
+        while (*pos != '\0' && *pos != '=' && *pos != '>' && !image_probe_is_space (pos)) pos++;
+        size_t name_len = pos - name;
+
+        while (image_probe_is_space (pos)) pos++;
+        if (*pos != '=') continue;
+        pos++;
+        while (image_probe_is_space (pos)) pos++;
+
+        char quote = *pos;
+        if (quote != '"' && quote != '\'') return false;
+        const char *value = ++pos;
+        while (*pos != '\0' && *pos != quote) pos++;
+        if (*pos == '\0') return false;
+        size_t value_len = pos - value;
+        pos++;
+
+        if (name_len == 5 && strncmp (name, "width", 5) == 0) {
+            has_width = image_probe_svg_length (value, value_len, &w);
+        } else if (name_len == 6 && strncmp (name, "height", 6) == 0) {
+            has_height = image_probe_svg_length (value, value_len, &h);
+        } else if (name_len == 7 && strncmp (name, "viewBox", 7) == 0) {
+            double x, y;
+            has_view_box = sscanf (value, "%lf%*[ ,]%lf%*[ ,]%lf%*[ ,]%lf", &x, &y, &vb_w, &vb_h) == 4 &&
+                vb_w > 0 && vb_h > 0;
+        }
+    }
+
+    // If only one dimension is given, the other one keeps the aspect ratio of
+    // the viewBox.
+    if (has_view_box) {
+        if (has_width && !has_height) {
+            h = w*vb_h/vb_w;
+            has_height = true;
+        } else if (!has_width && has_height) {
+            w = h*vb_w/vb_h;
+            has_width = true;
+        } else if (!has_width && !has_height) {
+            w = vb_w;
+            h = vb_h;
+            has_width = has_height = true;
+        }
+    }
+
+    if (!has_width || !has_height) return false;
+
+    *width = w;
+    *height = h;
+    return true;
+}
+
+// Returns false if path can't be opened. Otherwise st is set, and so are width
+// and height if the format was recognized, they are 0 if it wasn't.
+bool image_probe (const char *path, struct stat *st, int *width, int *height)
+{
+    *width = 0;
+    *height = 0;
+
+    int fd = open (path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    uint8_t data[IMAGE_PROBE_READ_SIZE + 1];
+    ssize_t len = 0;
+    bool success = fstat (fd, st) == 0;
+    if (success) {
+        len = pread (fd, data, IMAGE_PROBE_READ_SIZE, 0);
+        len = MAX (len, 0);
+    }
+    close (fd);
+
+    if (!success) {
+        return false;
+    }
+    data[len] = '\0';
+
+    double w, h;
+    if (image_probe_png (data, len, &w, &h) ||
+        image_probe_xpm ((char*)data, &w, &h) ||
+        image_probe_svg ((char*)data, &w, &h)) {
+        *width = (int)MIN (w + 0.5, INT_MAX);
+        *height = (int)MIN (h + 0.5, INT_MAX);
+    }
+    return true;
+}
@@ -0,0 +1,586 @@
+/*
+ * Copyright (C) 2018 Santiago León O.
+ */
+
+// Persistent index of all icon themes found at startup.
+//
+// Scanning all themes is the slowest part of starting the application, but the
+// icon directories almost never change between runs. After scanning, we write
+// everything we found into a binary file inside $XDG_CACHE_HOME. On the next
+// start this file is mmap'd and themes are created from it, pointing into the
+// mapped file instead of copying anything.
+//
+// Each theme stores a list of stamps, these are the modification times of all
+// directories that were scanned for it (and its index.theme file) taken before
+// scanning. Adding or removing an icon changes the modification time of the
+// directory that contains it, so if all stamps are the same, the names stored
+// for the theme are still valid. Only themes with a different stamp are
+// scanned again. Search paths are stamped too, if they didn't change then the
+// set of installed themes is the same, and we don't even need to look for
+// index.theme files.
+//
+// The file is not meant to be portable, integers are stored in native byte
+// order. If anything in the layout changes, STARTUP_INDEX_VERSION must be
+// incremented so old files get ignored and rewritten.
+//
+// Layout:
+//
+//   struct startup_index_header_t
+//   struct startup_index_stamp_t search_paths[num_search_paths]
+//   struct startup_index_theme_t themes[num_themes]
+//   For each theme:
+//       uint32_t dirs[num_dirs]                        (string offsets)
+//       struct startup_index_stamp_t stamps[num_stamps]
+//       struct startup_index_location_t locations[num_locations]
+//   Strings
+//
+// All strings are null terminated and stored once in the strings section, icon
+// names are shared by all themes that have them. A string offset of 0 means
+// NULL. Locations of the same icon name are stored next to each other.
+
+#include <sys/mman.h>
+
+#define STARTUP_INDEX_MAGIC 0x494e4349 // "ICNI"
+#define STARTUP_INDEX_VERSION 3
+
+struct startup_index_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+
+    uint32_t num_search_paths;
+    uint32_t search_paths;
+
+    uint32_t num_themes;
+    uint32_t themes;
+
+    uint32_t strings;
+    uint32_t strings_size;
+};
+
+struct startup_index_stamp_t {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path;
+    uint32_t padding;
+};
+
+struct startup_index_theme_t {
+    uint32_t name;
+    uint32_t dir_name;
+    uint32_t index_file;
+
+    uint32_t num_dirs;
+    uint32_t dirs;
+
+    uint32_t num_stamps;
+    uint32_t stamps;
+
+    uint32_t num_locations;
+    uint32_t locations;
+};
+
+// A struct icon_location_t of the icon called name.
+struct startup_index_location_t {
+    uint32_t name;
+    uint16_t dir;
+    uint16_t section;
+    uint8_t ext;
+    uint8_t padding[3];
+};
+
+struct startup_index_t {
+    uint8_t *data;
+    uint64_t size;
+
+    struct startup_index_header_t *header;
+    struct startup_index_theme_t *themes;
+    char *strings;
+};
+
+// In memory version of a stamp, used while scanning and writing the index.
+struct file_stamp_t {
+    char *path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+// Files that don't exist get a stamp of -1, so creating them invalidates it.
+static inline
+void file_stamp_get (const char *path, int64_t *mtime_sec, int64_t *mtime_nsec)
+{
+    struct stat st;
+    if (stat (path, &st) == 0) {
+        *mtime_sec = st.st_mtim.tv_sec;
+        *mtime_nsec = st.st_mtim.tv_nsec;
+    } else {
+        *mtime_sec = -1;
+        *mtime_nsec = -1;
+    }
+}
+
+static inline
+bool startup_index_stamp_is_valid (struct startup_index_t *index, struct startup_index_stamp_t *stamp)
+{
+    int64_t mtime_sec, mtime_nsec;
+    file_stamp_get (index->strings + stamp->path, &mtime_sec, &mtime_nsec);
+    return mtime_sec == stamp->mtime_sec && mtime_nsec == stamp->mtime_nsec;
+}
+
+static inline
+char* startup_index_str (struct startup_index_t *index, uint32_t offset)
+{
+    return offset == 0 ? NULL : index->strings + offset;
+}
+
+static inline
+void* startup_index_ptr (struct startup_index_t *index, uint32_t offset)
+{
+    return index->data + offset;
+}
+
+char* startup_index_path (mem_pool_t *pool)
+{
+    return pprintf (pool, "%s/iconoscope/startup.index", g_get_user_cache_dir ());
+}
+
+// Checks that count elements of size bytes at offset are inside the mapped
+// file, and aligned so they can be accessed in place.
+static inline
+bool startup_index_range_is_valid (struct startup_index_t *index,
+                                   uint32_t offset, uint32_t count, size_t size)
+{
+    return offset%8 == 0 && offset + (uint64_t)count*size <= index->size;
+}
+
+static inline
+bool startup_index_str_is_valid (struct startup_index_t *index, uint32_t offset)
+{
+    return offset < index->header->strings_size;
+}
+
+// Everything in the index is accessed without further checks, so a truncated
+// or corrupt file must be detected here. Strings are checked to be inside the
+// strings section, which must end with a null byte.
+//
+// NOTE: Sections of locations depend on the index.theme file of the theme,
+// they are checked by startup_index_theme_load() once it has been parsed.
+bool startup_index_is_valid (struct startup_index_t *index)
+{
+    struct startup_index_header_t *header = index->header;
+    if (header->strings_size == 0 ||
+        header->strings + (uint64_t)header->strings_size > index->size ||
+        index->strings[header->strings_size-1] != '\0') {
+        return false;
+    }
+
+    if (!startup_index_range_is_valid (index, header->search_paths, header->num_search_paths, sizeof(struct startup_index_stamp_t)) ||
+        !startup_index_range_is_valid (index, header->themes, header->num_themes, sizeof(struct startup_index_theme_t))) {
+        return false;
+    }
+
+    struct startup_index_stamp_t *search_paths = startup_index_ptr (index, header->search_paths);
+    for (uint32_t i=0; i<header->num_search_paths; i++) {
+        if (!startup_index_str_is_valid (index, search_paths[i].path)) {
+            return false;
+        }
+    }
+
+    for (uint32_t i=0; i<header->num_themes; i++) {
+        struct startup_index_theme_t *record = &index->themes[i];
+        if (!startup_index_str_is_valid (index, record->name) ||
+            !startup_index_str_is_valid (index, record->dir_name) ||
+            !startup_index_str_is_valid (index, record->index_file) ||
+            !startup_index_range_is_valid (index, record->dirs, record->num_dirs, sizeof(uint32_t)) ||
+            !startup_index_range_is_valid (index, record->stamps, record->num_stamps, sizeof(struct startup_index_stamp_t)) ||
+            !startup_index_range_is_valid (index, record->locations, record->num_locations, sizeof(struct startup_index_location_t))) {
+            return false;
+        }
+
+        // A theme with an index.theme file stores its stamp first.
+        if (record->index_file != 0 && record->num_stamps == 0) {
+            return false;
+        }
+
+        uint32_t *dirs = startup_index_ptr (index, record->dirs);
+        for (uint32_t j=0; j<record->num_dirs; j++) {
+            if (!startup_index_str_is_valid (index, dirs[j])) {
+                return false;
+            }
+        }
+
+        struct startup_index_stamp_t *stamps = startup_index_ptr (index, record->stamps);
+        for (uint32_t j=0; j<record->num_stamps; j++) {
+            if (!startup_index_str_is_valid (index, stamps[j].path)) {
+                return false;
+            }
+        }
+
+        struct startup_index_location_t *locations = startup_index_ptr (index, record->locations);
+        for (uint32_t j=0; j<record->num_locations; j++) {
+            if (!startup_index_str_is_valid (index, locations[j].name) ||
+                locations[j].dir >= record->num_dirs ||
+                locations[j].ext >= NUM_EXTENSIONS) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Maps the index file. Returns false if there is no index, it was written by a
+// different version or it's corrupt, all of which are handled as a cache miss.
+bool startup_index_map (struct startup_index_t *index)
+{
+    *index = ZERO_INIT (struct startup_index_t);
+
+    mem_pool_t pool = {0};
+    char *path = startup_index_path (&pool);
+
+    struct stat st;
+    int fd = open (path, O_RDONLY);
+    if (fd != -1) {
+        if (fstat (fd, &st) == 0 && st.st_size >= sizeof(struct startup_index_header_t)) {
+            void *data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                index->data = data;
+                index->size = st.st_size;
+            }
+        }
+        close (fd);
+    }
+    mem_pool_destroy (&pool);
+
+    if (index->data != NULL) {
+        struct startup_index_header_t *header = (struct startup_index_header_t*)index->data;
+        if (header->magic == STARTUP_INDEX_MAGIC &&
+            header->version == STARTUP_INDEX_VERSION &&
+            header->size == index->size) {
+            index->header = header;
+            index->themes = startup_index_ptr (index, header->themes);
+            index->strings = startup_index_ptr (index, header->strings);
+        }
+
+        if (index->header == NULL || !startup_index_is_valid (index)) {
+            if (index->header != NULL) {
+                printf ("Ignoring corrupt startup index.\n");
+            }
+            munmap (index->data, index->size);
+            *index = ZERO_INIT (struct startup_index_t);
+        }
+    }
+
+    return index->header != NULL;
+}
+
+void startup_index_unmap (struct startup_index_t *index)
+{
+    if (index->data != NULL) {
+        munmap (index->data, index->size);
+    }
+    *index = ZERO_INIT (struct startup_index_t);
+}
+
+// If search paths are the same, and none of them changed, then the themes
+// stored in the index are all the installed themes. For them to be usable
+// without reading anything else, their index.theme files must not have
+// changed either. The first stamp of a theme with an index.theme file is the
+// stamp of that file.
+bool startup_index_themes_are_valid (struct startup_index_t *index, char **path, int num_paths)
+{
+    if (index->header == NULL || index->header->num_search_paths != num_paths) {
+        return false;
+    }
+
+    struct startup_index_stamp_t *stamps = startup_index_ptr (index, index->header->search_paths);
+    for (int i=0; i<num_paths; i++) {
+        if (strcmp (index->strings + stamps[i].path, path[i]) != 0 ||
+            !startup_index_stamp_is_valid (index, &stamps[i])) {
+            return false;
+        }
+    }
+
+    for (uint32_t i=0; i<index->header->num_themes; i++) {
+        struct startup_index_theme_t *record = &index->themes[i];
+        if (record->index_file != 0) {
+            struct startup_index_stamp_t *theme_stamps = startup_index_ptr (index, record->stamps);
+            if (record->num_stamps == 0 ||
+                !startup_index_stamp_is_valid (index, &theme_stamps[0])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Sets the name, directory name, index file and directories of theme from a
+// theme stored in the index. Strings point into the mapped file.
+void startup_index_theme_init (struct startup_index_t *index,
+                               struct startup_index_theme_t *record,
+                               struct icon_theme_t *theme)
+{
+    theme->index_record = record;
+    theme->name = startup_index_str (index, record->name);
+    theme->dir_name = startup_index_str (index, record->dir_name);
+    theme->index_file = startup_index_str (index, record->index_file);
+    if (theme->index_file != NULL) {
+        struct startup_index_stamp_t *stamps = startup_index_ptr (index, record->stamps);
+        theme->index_file_path = index->strings + stamps[0].path;
+    }
+
+    theme->num_dirs = record->num_dirs;
+    theme->dirs = mem_pool_push_array (&theme->pool, record->num_dirs, char*);
+    uint32_t *dirs = startup_index_ptr (index, record->dirs);
+    for (uint32_t i=0; i<record->num_dirs; i++) {
+        theme->dirs[i] = startup_index_str (index, dirs[i]);
+    }
+}
+
+// Used when the set of themes changed, and themes were found by reading the
+// search paths. Finds the theme in the index that was stored for the same
+// directories.
+struct startup_index_theme_t* startup_index_find_theme (struct startup_index_t *index,
+                                                        struct icon_theme_t *theme)
+{
+    if (index->header == NULL) {
+        return NULL;
+    }
+
+    for (uint32_t i=0; i<index->header->num_themes; i++) {
+        struct startup_index_theme_t *record = &index->themes[i];
+        char *dir_name = startup_index_str (index, record->dir_name);
+
+        if (record->num_dirs != theme->num_dirs ||
+            (dir_name == NULL) != (theme->dir_name == NULL) ||
+            (dir_name != NULL && strcmp (dir_name, theme->dir_name) != 0)) {
+            continue;
+        }
+
+        uint32_t *dirs = startup_index_ptr (index, record->dirs);
+        uint32_t j;
+        for (j=0; j<record->num_dirs; j++) {
+            if (strcmp (index->strings + dirs[j], theme->dirs[j]) != 0) break;
+        }
+
+        if (j == record->num_dirs) {
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+// Checks all stamps of the theme's index record. If none changed, the icon
+// names are loaded from the index and true is returned. Otherwise the theme
+// needs to be scanned. The sections of the theme must have been parsed
+// already, locations pointing to a section it doesn't have also make it
+// scanned again.
+bool startup_index_theme_load (struct startup_index_t *index, struct icon_theme_t *theme)
+{
+    struct startup_index_theme_t *record = theme->index_record;
+    if (record == NULL) {
+        return false;
+    }
+
+    struct startup_index_stamp_t *stamps = startup_index_ptr (index, record->stamps);
+    for (uint32_t i=0; i<record->num_stamps; i++) {
+        if (!startup_index_stamp_is_valid (index, &stamps[i])) {
+            return false;
+        }
+    }
+
+    struct startup_index_location_t *locations = startup_index_ptr (index, record->locations);
+    for (uint32_t i=0; i<record->num_locations; i++) {
+        if (locations[i].section != ICON_LOCATION_NO_SECTION &&
+            locations[i].section >= theme->num_sections) {
+            return false;
+        }
+    }
+
+    theme->num_stamps = record->num_stamps;
+    theme->stamps = mem_pool_push_array (&theme->pool, record->num_stamps, struct file_stamp_t);
+    for (uint32_t i=0; i<record->num_stamps; i++) {
+        theme->stamps[i].path = index->strings + stamps[i].path;
+        theme->stamps[i].mtime_sec = stamps[i].mtime_sec;
+        theme->stamps[i].mtime_nsec = stamps[i].mtime_nsec;
+    }
+
+    theme->scan_icon_names = g_hash_table_new (g_str_hash, g_str_equal);
+    struct icon_location_t *new_locations =
+        mem_pool_push_array (&theme->pool, record->num_locations, struct icon_location_t);
+    for (uint32_t i=0; i<record->num_locations; i++) {
+        struct icon_location_t *new_location = &new_locations[i];
+        new_location->dir = locations[i].dir;
+        new_location->section = locations[i].section;
+        new_location->ext = locations[i].ext;
+        new_location->next = NULL;
+
+        if (i > 0 && locations[i].name == locations[i-1].name) {
+            new_location->next = &new_locations[i-1];
+        }
+        g_hash_table_insert (theme->scan_icon_names, index->strings + locations[i].name, new_location);
+    }
+
+    return true;
+}
+
+struct startup_index_writer_t {
+    cont_buff_t data;
+    cont_buff_t strings;
+    GHashTable *string_offsets;
+};
+
+uint32_t startup_index_intern (struct startup_index_writer_t *wr, const char *str)
+{
+    if (str == NULL) {
+        return 0;
+    }
+
+    gpointer offset;
+    if (!g_hash_table_lookup_extended (wr->string_offsets, str, NULL, &offset)) {
+        size_t len = strlen (str) + 1;
+        offset = GUINT_TO_POINTER (wr->strings.used);
+        memcpy (cont_buff_push (&wr->strings, len), str, len);
+        g_hash_table_insert (wr->string_offsets, (gpointer)str, offset);
+    }
+    return GPOINTER_TO_UINT (offset);
+}
+
+// Pushes size bytes into the data section, aligned to 8 bytes, and returns the
+// offset where they start. Pointers into the data section are invalidated by
+// this.
+uint32_t startup_index_push (struct startup_index_writer_t *wr, uint32_t size)
+{
+    uint32_t padding = (8 - wr->data.used%8)%8;
+    if (padding > 0) {
+        memset (cont_buff_push (&wr->data, padding), 0, padding);
+    }
+
+    uint32_t offset = wr->data.used;
+    if (size > 0) {
+        memset (cont_buff_push (&wr->data, size), 0, size);
+    }
+    return offset;
+}
+
+#define startup_index_at(wr,offset,type) ((type*)((uint8_t*)(wr)->data.data + (offset)))
+
+void startup_index_write (struct atom_table_t *atoms,
+                          struct icon_theme_t **themes, int num_themes, char **path, int num_paths)
+{
+    struct startup_index_writer_t wr = {0};
+    wr.string_offsets = g_hash_table_new (g_str_hash, g_str_equal);
+
+    // Icon names are atoms, their string offsets are cached by atom so each
+    // one is only hashed once. Scanning threads are done, so num_atoms is not
+    // changing anymore.
+    uint32_t *atom_offsets = calloc (atoms->num_atoms, sizeof(uint32_t));
+
+    // Offset 0 is reserved for NULL.
+    *(char*)cont_buff_push (&wr.strings, 1) = '\0';
+
+    uint32_t header = startup_index_push (&wr, sizeof(struct startup_index_header_t));
+
+    uint32_t search_paths =
+        startup_index_push (&wr, num_paths*sizeof(struct startup_index_stamp_t));
+    for (int i=0; i<num_paths; i++) {
+        struct startup_index_stamp_t *stamp =
+            startup_index_at (&wr, search_paths, struct startup_index_stamp_t) + i;
+        stamp->path = startup_index_intern (&wr, path[i]);
+        file_stamp_get (path[i], &stamp->mtime_sec, &stamp->mtime_nsec);
+    }
+
+    uint32_t records = startup_index_push (&wr, num_themes*sizeof(struct startup_index_theme_t));
+    for (int i=0; i<num_themes; i++) {
+        struct icon_theme_t *theme = themes[i];
+        struct startup_index_theme_t record = {0};
+        record.name = startup_index_intern (&wr, theme->name);
+        record.dir_name = startup_index_intern (&wr, theme->dir_name);
+        record.index_file = startup_index_intern (&wr, theme->index_file);
+
+        record.num_dirs = theme->num_dirs;
+        record.dirs = startup_index_push (&wr, theme->num_dirs*sizeof(uint32_t));
+        for (uint32_t j=0; j<theme->num_dirs; j++) {
+            uint32_t offset = startup_index_intern (&wr, theme->dirs[j]);
+            startup_index_at (&wr, record.dirs, uint32_t)[j] = offset;
+        }
+
+        record.num_stamps = theme->num_stamps;
+        record.stamps = startup_index_push (&wr, theme->num_stamps*sizeof(struct startup_index_stamp_t));
+        for (uint32_t j=0; j<theme->num_stamps; j++) {
+            uint32_t offset = startup_index_intern (&wr, theme->stamps[j].path);
+            struct startup_index_stamp_t *stamp =
+                startup_index_at (&wr, record.stamps, struct startup_index_stamp_t) + j;
+            stamp->path = offset;
+            stamp->mtime_sec = theme->stamps[j].mtime_sec;
+            stamp->mtime_nsec = theme->stamps[j].mtime_nsec;
+        }
+
+        uint32_t it;
+        atom_t atom;
+        void *value;
+        record.num_locations = 0;
+        it = 0;
+        while (atom_map_next (&theme->icon_names, &it, &atom, &value)) {
+            for (struct icon_location_t *l = value; l != NULL; l = l->next) {
+                record.num_locations++;
+            }
+        }
+
+        record.locations = startup_index_push (&wr, record.num_locations*sizeof(struct startup_index_location_t));
+        uint32_t j = 0;
+        it = 0;
+        while (atom_map_next (&theme->icon_names, &it, &atom, &value)) {
+            if (atom_offsets[atom] == 0) {
+                atom_offsets[atom] = startup_index_intern (&wr, atom_str (atoms, atom));
+            }
+            uint32_t offset = atom_offsets[atom];
+            for (struct icon_location_t *l = value; l != NULL; l = l->next) {
+                struct startup_index_location_t *location =
+                    startup_index_at (&wr, record.locations, struct startup_index_location_t) + j++;
+                location->name = offset;
+                location->dir = l->dir;
+                location->section = l->section;
+                location->ext = l->ext;
+            }
+        }
+
+        startup_index_at (&wr, records, struct startup_index_theme_t)[i] = record;
+    }
+
+    uint32_t strings = startup_index_push (&wr, wr.strings.used);
+    memcpy (startup_index_at (&wr, strings, char), wr.strings.data, wr.strings.used);
+
+    struct startup_index_header_t *hdr = startup_index_at (&wr, header, struct startup_index_header_t);
+    hdr->magic = STARTUP_INDEX_MAGIC;
+    hdr->version = STARTUP_INDEX_VERSION;
+    hdr->size = wr.data.used;
+    hdr->num_search_paths = num_paths;
+    hdr->search_paths = search_paths;
+    hdr->num_themes = num_themes;
+    hdr->themes = records;
+    hdr->strings = strings;
+    hdr->strings_size = wr.strings.used;
+
+    // Write into a temporary file and rename it, so a running instance that
+    // has the old index mapped is not affected, and a failed write never
+    // leaves a truncated index behind.
+    mem_pool_t pool = {0};
+    char *index_path = startup_index_path (&pool);
+    char *tmp_path = pprintf (&pool, "%s.%d.tmp", index_path, getpid());
+    if (ensure_path_exists (index_path) &&
+        !full_file_write (wr.data.data, wr.data.used, tmp_path)) {
+        if (rename (tmp_path, index_path) == -1) {
+            printf ("Could not replace %s: %s\n", index_path, strerror(errno));
+            unlink (tmp_path);
+        }
+    }
+    mem_pool_destroy (&pool);
+
+    free (atom_offsets);
+    g_hash_table_destroy (wr.string_offsets);
+    cont_buff_destroy (&wr.data);
+    cont_buff_destroy (&wr.strings);
+}